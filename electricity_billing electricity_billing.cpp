@@ -8,6 +8,33 @@
 #include <limits>
 #include <ctime>
 #include <sstream>
+#include <memory>
+#include <numeric>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <cstdlib>
+#include <charconv>
+#include <filesystem>
+#include <atomic>
+#include <cstdint>
+#include <unordered_map>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <cmath>
+#include <cstdio>
+#include <condition_variable>
+#include <deque>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
@@ -23,11 +50,54 @@ struct Customer {
     double billAmount;
     string billingDate;
     bool isPaid;
+    string dueDate;
+    double lateFee;
+    int dunningLevel;   // number of dunning stages already applied to this bill
+    int64_t coldRef;    // record position in customers.dat holding name/address/contact, -1 if held here
+    int category;       // TariffCategory
+    uint32_t localityID; // index into localityNames, derived from the address
     
     Customer() : customerID(0), previousReading(0.0), currentReading(0.0), 
-                 unitsConsumed(0.0), billAmount(0.0), isPaid(false) {}
+                 unitsConsumed(0.0), billAmount(0.0), isPaid(false),
+                 lateFee(0.0), dunningLevel(0), coldRef(-1),
+                 category(0), localityID(0) {}
+};
+
+// Text fields that may be kept on disk until needed
+struct ColdFields {
+    string name;
+    string address;
+    string contact;
+};
+
+enum ColdField { COLD_NAME, COLD_ADDRESS, COLD_CONTACT };
+
+struct ColdBlock;
+
+// Reads single text fields for many customers. It keeps the last block it
+// used, so a run of rows from one block takes the cache lock only once.
+struct ColdFieldReader {
+    size_t blockIndex;
+    shared_ptr<ColdBlock> block;
+
+    ColdFieldReader() : blockIndex(numeric_limits<size_t>::max()) {}
+
+    string read(const Customer &customer, ColdField field);
+    string read(int64_t coldRef, uint32_t localityID, ColdField field);
 };
 
+// Bill totals shown by the system report
+struct ReportTotals {
+    int paidBills;
+    int pendingBills;
+    double totalRevenue;
+    double totalPending;
+};
+
+enum TariffCategory { CATEGORY_DOMESTIC, CATEGORY_COMMERCIAL, CATEGORY_INDUSTRIAL, CATEGORY_COUNT };
+
+const char *const CATEGORY_NAMES[CATEGORY_COUNT] = {"Domestic", "Commercial", "Industrial"};
+
 // Structure for tariff rates
 struct Tariff {
     double domesticRate;
@@ -40,8 +110,20 @@ struct Tariff {
 // Global variables
 vector<Customer> customers;
 Tariff currentTariff;
+vector<string> localityNames(1, "Unknown"); // dictionary of localities, 0 = no locality
+unordered_map<string, uint32_t> localityIndex;
+unordered_map<int, size_t> customerIndex; // customer ID -> position in customers
 const string DATA_FILE = "customers.dat";
 const string TARIFF_FILE = "tariff.dat";
+const string DUNNING_LOG_FILE = "dunning.log";
+const string SHARED_STORE_FILE = "customers.shm";
+const uint64_t DATA_FILE_MAGIC = 0x3156415441444245ULL; // "EBDATAV1" marks versioned files
+const uint32_t DATA_FILE_VERSION = 5;
+const int BILL_DUE_DAYS = 15;
+const size_t CUSTOMER_NOT_FOUND = numeric_limits<size_t>::max();
+int dunningClock = -1;   // last day processed by the dunning scheduler (days since 1970-01-01)
+int simulatedToday = -1; // set by --as-of to run against a simulated date
+bool replayMode = false; // --replay: the session leaves no files behind
 
 // Function prototypes
 void displayMenu();
@@ -57,31 +139,158 @@ void viewPaidBills();
 void viewPendingBills();
 void updateTariff();
 void generateReport();
-void saveData();
+void generateGroupReport();
+void topConsumersReport();
+void runDunning();
+void queryCustomers();
+void printAllInvoices();
+void exportCustomers();
+void finishExport();
+void printExportStatus();
+bool saveData();
 void loadData();
+void compareDataFormats();
 void saveTariff();
 void loadTariff();
+size_t findCustomer(int id);
+void rebuildCustomerIndex();
+bool insertCustomer(Customer &customer);
+bool billCustomer(size_t index, double currentReading);
+bool payCustomer(size_t index);
+bool updateCustomerField(size_t index, int field, const string &value);
+bool deleteCustomerRecord(size_t index);
+void setTariffRate(int category, double rate);
+vector<size_t> searchCustomersByName(const string &part);
+ReportTotals computeReportTotals();
+bool startRecording(const string &path);
+void recordCommand(const vector<string> &fields);
+int runReplay(const string &path, double rate);
+string formatNumber(double value);
+string renderBillText(const Customer &customer);
+ColdFields coldFields(const Customer &customer);
+string customerName(const Customer &customer);
+string customerAddress(const Customer &customer);
+string customerContact(const Customer &customer);
+void makeResident(Customer &customer);
+size_t damagedColdBlocks();
+void recordConsumption(double units);
+void forgetConsumption();
+void rebuildConsumptionSketch();
 string getCurrentDate();
+string toLowerCopy(string text);
+uint32_t localityIDFor(const string &address);
+int daysFromDate(const string &date);
+string dateFromDays(int days);
+void startDunningScheduler(int today);
+void rebuildDunningWheel();
+bool openSharedStore();
+void syncFromSharedStore();
+bool commitCustomer(size_t index);
+void recordDataFileSaved();
+bool commitCustomerDeletion(int id);
+void commitTariff();
+int allocateSharedCustomerID();
+int lockDataFile();
+void unlockDataFile(int fd);
+void scheduleNextDunning(const Customer &customer);
+struct DunningEvent;
+vector<DunningEvent> advanceDunningClock(int targetDay);
 int generateCustomerID();
 void clearScreen();
 void pressEnterToContinue();
 double getValidDouble(const string &prompt);
 int getValidInt(const string &prompt);
+int getValidCategory();
+string getValidText(const string &prompt, int field);
 
-int main() {
-    loadData();
+int main(int argc, char *argv[]) {
+    bool sharedMode = false;
+    bool compareFormats = false;
+    string replayFile;
+    double replayRate = 0.0;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        string asOf;
+        if (arg == "--shared") {
+            sharedMode = true;
+            continue;
+        } else if (arg == "--compare-formats") {
+            compareFormats = true;
+            continue;
+        } else if (arg == "--replay" && i + 1 < argc) {
+            replayFile = argv[++i];
+            continue;
+        } else if (arg == "--rate" && i + 1 < argc) {
+            replayRate = atof(argv[++i]);
+            continue;
+        } else if (arg == "--record" && i + 1 < argc) {
+            if (!startRecording(argv[++i])) {
+                return 1;
+            }
+            continue;
+        } else if (arg == "--as-of" && i + 1 < argc) {
+            asOf = argv[++i];
+        } else if (arg.rfind("--as-of=", 0) == 0) {
+            asOf = arg.substr(8);
+        } else {
+            cout << "Usage: " << argv[0] << " [--as-of YYYY-MM-DD] [--shared] [--compare-formats]\n"
+                 << "       [--replay FILE [--rate COMMANDS_PER_SEC]] [--record FILE]\n";
+            return 1;
+        }
+        simulatedToday = daysFromDate(asOf);
+        if (simulatedToday < 0) {
+            cout << "Invalid --as-of date: " << asOf << " (expected YYYY-MM-DD)\n";
+            return 1;
+        }
+    }
+    
+    if (compareFormats) {
+        compareDataFormats();
+        return 0;
+    }
+    
+    // Replay changes the book it runs against, and in shared mode that is
+    // the store every other console works on
+    if (sharedMode && !replayFile.empty()) {
+        cout << "--replay cannot be combined with --shared.\n";
+        return 1;
+    }
+    
+    replayMode = !replayFile.empty();
     loadTariff();
+    if (sharedMode) {
+        if (!openSharedStore()) {
+            return 1;
+        }
+    } else {
+        loadData();
+    }
+    startDunningScheduler(daysFromDate(getCurrentDate()));
+    if (!sharedMode) {
+        rebuildConsumptionSketch(); // shared mode built it from the store
+    }
+    
+    if (!replayFile.empty()) {
+        return runReplay(replayFile, replayRate);
+    }
     
     int choice;
     do {
         clearScreen();
         displayMenu();
+        printExportStatus();
         cout << "Enter your choice: ";
         cin >> choice;
         
         // Clear input buffer
         cin.ignore(numeric_limits<streamsize>::max(), '\n');
         
+        // The prompt may have waited a long time: pick up changes made by
+        // other operators in shared mode, and keep the dunning clock in
+        // step with real time across midnight
+        syncFromSharedStore();
+        advanceDunningClock(daysFromDate(getCurrentDate()));
+        
         switch(choice) {
             case 1:
                 addCustomer();
@@ -117,17 +326,37 @@ int main() {
                 generateReport();
                 break;
             case 12:
-                saveData();
+                queryCustomers();
+                break;
+            case 13:
+                printAllInvoices();
+                break;
+            case 14:
+                runDunning();
+                break;
+            case 15:
+                generateGroupReport();
+                break;
+            case 16:
+                topConsumersReport();
+                break;
+            case 17:
+                exportCustomers();
+                break;
+            case 18: {
+                bool saved = saveData();
                 saveTariff();
-                cout << "\nData saved successfully. Exiting...\n";
+                cout << (saved ? "\nData saved successfully. Exiting...\n"
+                               : "\nExiting without saving customer data.\n");
                 break;
+            }
             default:
-                if (choice != 12) {
+                if (choice != 18) {
                     cout << "\nInvalid choice! Please try again.\n";
                     pressEnterToContinue();
                 }
         }
-    } while (choice != 12);
+    } while (choice != 18);
     
     return 0;
 }
@@ -147,7 +376,13 @@ void displayMenu() {
     cout << "9. View Pending Bills\n";
     cout << "10. Update Tariff Rates\n";
     cout << "11. Generate Report\n";
-    cout << "12. Exit and Save Data\n";
+    cout << "12. Query Customers\n";
+    cout << "13. Print All Invoices\n";
+    cout << "14. Run Dunning (Late Fees & Reminders)\n";
+    cout << "15. Group-By Report\n";
+    cout << "16. Top Consumers & Percentiles\n";
+    cout << "17. Export Customer Book (CSV / Columnar)\n";
+    cout << "18. Exit and Save Data\n";
     cout << "=========================================\n";
 }
 
@@ -160,22 +395,23 @@ void addCustomer() {
     
     cout << "Customer ID: " << newCustomer.customerID << endl;
     
-    cout << "Enter Customer Name: ";
-    getline(cin, newCustomer.name);
-    
-    cout << "Enter Address: ";
-    getline(cin, newCustomer.address);
+    newCustomer.name = getValidText("Enter Customer Name: ", 1);
+    newCustomer.address = getValidText("Enter Address: ", 2);
+    newCustomer.contact = getValidText("Enter Contact Number: ", 3);
     
-    cout << "Enter Contact Number: ";
-    getline(cin, newCustomer.contact);
+    newCustomer.category = getValidCategory();
     
     newCustomer.previousReading = getValidDouble("Enter Previous Meter Reading: ");
     newCustomer.currentReading = getValidDouble("Enter Current Meter Reading: ");
     
-    // Calculate initial bill
-    calculateBill(newCustomer);
-    
-    customers.push_back(newCustomer);
+    if (!insertCustomer(newCustomer)) {
+        cout << "\nCustomer not added, please retry.\n";
+        pressEnterToContinue();
+        return;
+    }
+    recordCommand({"add", newCustomer.name, newCustomer.address, newCustomer.contact,
+                   to_string(newCustomer.category + 1), formatNumber(newCustomer.previousReading),
+                   formatNumber(newCustomer.currentReading)});
     
     cout << "\nCustomer added successfully!\n";
     cout << "Generated Customer ID: " << newCustomer.customerID << endl;
@@ -186,9 +422,14 @@ void addCustomer() {
 void calculateBill(Customer &customer) {
     customer.unitsConsumed = customer.currentReading - customer.previousReading;
     
-    // Apply tariff (using domestic rate as default for simplicity)
-    // In a real system, you would ask for customer type
-    customer.billAmount = customer.unitsConsumed * currentTariff.domesticRate;
+    // Apply the rate for the customer's tariff category
+    double rate = currentTariff.domesticRate;
+    if (customer.category == CATEGORY_COMMERCIAL) {
+        rate = currentTariff.commercialRate;
+    } else if (customer.category == CATEGORY_INDUSTRIAL) {
+        rate = currentTariff.industrialRate;
+    }
+    customer.billAmount = customer.unitsConsumed * rate;
     
     // Add fixed charges and tax (simplified)
     double fixedCharge = 50.0; // Fixed monthly charge
@@ -199,6 +440,12 @@ void calculateBill(Customer &customer) {
     
     customer.billingDate = getCurrentDate();
     customer.isPaid = false;
+    
+    // A new bill starts a fresh dunning cycle
+    customer.dueDate = dateFromDays(daysFromDate(customer.billingDate) + BILL_DUE_DAYS);
+    customer.lateFee = 0.0;
+    customer.dunningLevel = 0;
+    scheduleNextDunning(customer);
 }
 
 void generateBill() {
@@ -214,40 +461,26 @@ void generateBill() {
     int id = getValidInt("Enter Customer ID: ");
     
     // Search for customer
-    auto it = find_if(customers.begin(), customers.end(), 
-                     [id](const Customer &c) { return c.customerID == id; });
-    
-    if (it == customers.end()) {
+    size_t index = findCustomer(id);
+    if (index == CUSTOMER_NOT_FOUND) {
         cout << "Customer not found with ID: " << id << endl;
         pressEnterToContinue();
         return;
     }
     
     cout << "\nEnter new meter reading for billing:\n";
-    it->previousReading = it->currentReading;
-    it->currentReading = getValidDouble("Enter Current Meter Reading: ");
+    double reading = getValidDouble("Enter Current Meter Reading: ");
     
-    calculateBill(*it);
+    if (!billCustomer(index, reading)) {
+        cout << "Another operator changed this customer meanwhile. Bill not saved, please retry.\n";
+        pressEnterToContinue();
+        return;
+    }
+    recordCommand({"bill", to_string(id), formatNumber(reading)});
     
     // Display the bill
     clearScreen();
-    cout << "=========================================\n";
-    cout << "        ELECTRICITY BILL\n";
-    cout << "=========================================\n";
-    cout << "Bill Date: " << it->billingDate << endl;
-    cout << "Customer ID: " << it->customerID << endl;
-    cout << "Customer Name: " << it->name << endl;
-    cout << "Address: " << it->address << endl;
-    cout << "Contact: " << it->contact << endl;
-    cout << "-----------------------------------------\n";
-    cout << fixed << setprecision(2);
-    cout << "Previous Reading: " << it->previousReading << " units\n";
-    cout << "Current Reading: " << it->currentReading << " units\n";
-    cout << "Units Consumed: " << it->unitsConsumed << " units\n";
-    cout << "-----------------------------------------\n";
-    cout << "Bill Amount: Rs. " << it->billAmount << endl;
-    cout << "Payment Status: " << (it->isPaid ? "PAID" : "PENDING") << endl;
-    cout << "=========================================\n";
+    cout << renderBillText(customers[index]);
     
     pressEnterToContinue();
 }
@@ -272,9 +505,10 @@ void viewAllCustomers() {
     
     cout << fixed << setprecision(2);
     for (const auto &customer : customers) {
+        string name = customerName(customer);
         cout << left << setw(10) << customer.customerID
-             << setw(20) << (customer.name.length() > 18 ? customer.name.substr(0, 15) + "..." : customer.name)
-             << setw(15) << customer.contact
+             << setw(20) << (name.length() > 18 ? name.substr(0, 15) + "..." : name)
+             << setw(15) << customerContact(customer)
              << setw(12) << customer.unitsConsumed
              << setw(12) << customer.billAmount
              << setw(10) << (customer.isPaid ? "PAID" : "PENDING") << endl;
@@ -304,22 +538,26 @@ void searchCustomer() {
     if (choice == 1) {
         int id = getValidInt("Enter Customer ID: ");
         
-        auto it = find_if(customers.begin(), customers.end(),
-                         [id](const Customer &c) { return c.customerID == id; });
-        
-        if (it != customers.end()) {
+        size_t index = findCustomer(id);
+        if (index != CUSTOMER_NOT_FOUND) {
+            recordCommand({"search", "id", to_string(id)});
+            auto it = customers.begin() + index;
             clearScreen();
             cout << "=== CUSTOMER DETAILS ===\n\n";
             cout << "Customer ID: " << it->customerID << endl;
-            cout << "Name: " << it->name << endl;
-            cout << "Address: " << it->address << endl;
-            cout << "Contact: " << it->contact << endl;
+            ColdFields fields = coldFields(*it);
+            cout << "Name: " << fields.name << endl;
+            cout << "Address: " << fields.address << endl;
+            cout << "Contact: " << fields.contact << endl;
+            cout << "Tariff Category: " << CATEGORY_NAMES[it->category] << endl;
             cout << fixed << setprecision(2);
             cout << "Previous Reading: " << it->previousReading << " units\n";
             cout << "Current Reading: " << it->currentReading << " units\n";
             cout << "Units Consumed: " << it->unitsConsumed << " units\n";
             cout << "Bill Amount: Rs. " << it->billAmount << endl;
             cout << "Billing Date: " << it->billingDate << endl;
+            cout << "Due Date: " << it->dueDate << endl;
+            cout << "Late Fee: Rs. " << it->lateFee << endl;
             cout << "Payment Status: " << (it->isPaid ? "PAID" : "PENDING") << endl;
         } else {
             cout << "Customer not found with ID: " << id << endl;
@@ -328,30 +566,23 @@ void searchCustomer() {
         string name;
         cout << "Enter Customer Name (or part): ";
         getline(cin, name);
+        recordCommand({"search", "name", name});
         
-        // Convert to lowercase for case-insensitive search
-        transform(name.begin(), name.end(), name.begin(), ::tolower);
-        
-        bool found = false;
-        for (const auto &customer : customers) {
-            string customerNameLower = customer.name;
-            transform(customerNameLower.begin(), customerNameLower.end(), customerNameLower.begin(), ::tolower);
-            
-            if (customerNameLower.find(name) != string::npos) {
-                if (!found) {
-                    clearScreen();
-                    cout << "=== SEARCH RESULTS ===\n\n";
-                    found = true;
-                }
-                cout << "ID: " << customer.customerID 
-                     << " | Name: " << customer.name 
-                     << " | Contact: " << customer.contact 
-                     << " | Bill: Rs. " << fixed << setprecision(2) << customer.billAmount
-                     << " | Status: " << (customer.isPaid ? "PAID" : "PENDING") << endl;
-            }
+        vector<size_t> matches = searchCustomersByName(name);
+        if (!matches.empty()) {
+            clearScreen();
+            cout << "=== SEARCH RESULTS ===\n\n";
+        }
+        for (size_t index : matches) {
+            const Customer &customer = customers[index];
+            cout << "ID: " << customer.customerID 
+                 << " | Name: " << customerName(customer) 
+                 << " | Contact: " << customerContact(customer) 
+                 << " | Bill: Rs. " << fixed << setprecision(2) << customer.billAmount
+                 << " | Status: " << (customer.isPaid ? "PAID" : "PENDING") << endl;
         }
         
-        if (!found) {
+        if (matches.empty()) {
             cout << "No customers found with name containing: " << name << endl;
         }
     } else {
@@ -373,45 +604,47 @@ void updateCustomer() {
     
     int id = getValidInt("Enter Customer ID to update: ");
     
-    auto it = find_if(customers.begin(), customers.end(),
-                     [id](const Customer &c) { return c.customerID == id; });
-    
-    if (it == customers.end()) {
+    size_t index = findCustomer(id);
+    if (index == CUSTOMER_NOT_FOUND) {
         cout << "Customer not found with ID: " << id << endl;
         pressEnterToContinue();
         return;
     }
     
+    auto it = customers.begin() + index;
+    makeResident(*it);
     cout << "\nCurrent Details:\n";
     cout << "1. Name: " << it->name << endl;
     cout << "2. Address: " << it->address << endl;
     cout << "3. Contact: " << it->contact << endl;
     cout << "4. Previous Reading: " << it->previousReading << endl;
     cout << "5. Current Reading: " << it->currentReading << endl;
+    cout << "6. Tariff Category: " << CATEGORY_NAMES[it->category] << endl;
     
     int choice;
-    cout << "\nSelect field to update (1-5, 0 to cancel): ";
+    cout << "\nSelect field to update (1-6, 0 to cancel): ";
     cin >> choice;
     cin.ignore();
     
+    string value;
     switch(choice) {
         case 1:
-            cout << "Enter new Name: ";
-            getline(cin, it->name);
+            value = getValidText("Enter new Name: ", 1);
             break;
         case 2:
-            cout << "Enter new Address: ";
-            getline(cin, it->address);
+            value = getValidText("Enter new Address: ", 2);
             break;
         case 3:
-            cout << "Enter new Contact: ";
-            getline(cin, it->contact);
+            value = getValidText("Enter new Contact: ", 3);
             break;
         case 4:
-            it->previousReading = getValidDouble("Enter new Previous Reading: ");
+            value = formatNumber(getValidDouble("Enter new Previous Reading: "));
             break;
         case 5:
-            it->currentReading = getValidDouble("Enter new Current Reading: ");
+            value = formatNumber(getValidDouble("Enter new Current Reading: "));
+            break;
+        case 6:
+            value = to_string(getValidCategory() + 1);
             break;
         case 0:
             cout << "Update cancelled.\n";
@@ -420,12 +653,16 @@ void updateCustomer() {
             cout << "Invalid choice!\n";
     }
     
-    if (choice >= 1 && choice <= 5) {
-        // Recalculate bill if readings were updated
-        if (choice == 4 || choice == 5) {
-            calculateBill(*it);
+    if (choice >= 1 && choice <= 6) {
+        if (updateCustomerField(index, choice, value)) {
+            recordCommand({"update", to_string(id), to_string(choice), value});
+            cout << "Customer details updated successfully!\n";
+            if (choice == 6) {
+                cout << "The new category applies from the next bill.\n";
+            }
+        } else {
+            cout << "Another operator changed this customer meanwhile. Update not saved, please retry.\n";
         }
-        cout << "Customer details updated successfully!\n";
     }
     
     pressEnterToContinue();
@@ -443,24 +680,27 @@ void deleteCustomer() {
     
     int id = getValidInt("Enter Customer ID to delete: ");
     
-    auto it = find_if(customers.begin(), customers.end(),
-                     [id](const Customer &c) { return c.customerID == id; });
-    
-    if (it == customers.end()) {
+    size_t index = findCustomer(id);
+    if (index == CUSTOMER_NOT_FOUND) {
         cout << "Customer not found with ID: " << id << endl;
         pressEnterToContinue();
         return;
     }
     
     cout << "\nCustomer Found:\n";
-    cout << "ID: " << it->customerID << ", Name: " << it->name << endl;
+    cout << "ID: " << id << ", Name: " << customerName(customers[index]) << endl;
     
     char confirm;
     cout << "Are you sure you want to delete this customer? (y/n): ";
     cin >> confirm;
     
     if (tolower(confirm) == 'y') {
-        customers.erase(it);
+        if (!deleteCustomerRecord(index)) {
+            cout << "Another operator changed this customer meanwhile. Deletion cancelled, please retry.\n";
+            pressEnterToContinue();
+            return;
+        }
+        recordCommand({"delete", to_string(id)});
         cout << "Customer deleted successfully!\n";
     } else {
         cout << "Deletion cancelled.\n";
@@ -481,32 +721,39 @@ void payBill() {
     
     int id = getValidInt("Enter Customer ID to pay bill: ");
     
-    auto it = find_if(customers.begin(), customers.end(),
-                     [id](const Customer &c) { return c.customerID == id; });
-    
-    if (it == customers.end()) {
+    size_t index = findCustomer(id);
+    if (index == CUSTOMER_NOT_FOUND) {
         cout << "Customer not found with ID: " << id << endl;
         pressEnterToContinue();
         return;
     }
     
+    auto it = customers.begin() + index;
     if (it->isPaid) {
         cout << "Bill is already paid!\n";
         pressEnterToContinue();
         return;
     }
     
-    cout << "\nCustomer: " << it->name << endl;
+    cout << "\nCustomer: " << customerName(*it) << endl;
     cout << "Bill Amount: Rs. " << fixed << setprecision(2) << it->billAmount << endl;
     cout << "Billing Date: " << it->billingDate << endl;
+    cout << "Due Date: " << it->dueDate << endl;
+    if (it->lateFee > 0) {
+        cout << "Includes Late Fee: Rs. " << it->lateFee << endl;
+    }
     
     char confirm;
     cout << "\nConfirm payment? (y/n): ";
     cin >> confirm;
     
     if (tolower(confirm) == 'y') {
-        it->isPaid = true;
-        cout << "Payment recorded successfully!\n";
+        if (payCustomer(index)) {
+            recordCommand({"pay", to_string(id)});
+            cout << "Payment recorded successfully!\n";
+        } else {
+            cout << "Another operator changed this customer meanwhile. Payment not recorded, please retry.\n";
+        }
     } else {
         cout << "Payment cancelled.\n";
     }
@@ -532,8 +779,9 @@ void viewPaidBills() {
         if (customer.isPaid) {
             found = true;
             totalPaid += customer.billAmount;
+            string name = customerName(customer);
             cout << left << setw(10) << customer.customerID
-                 << setw(20) << (customer.name.length() > 18 ? customer.name.substr(0, 15) + "..." : customer.name)
+                 << setw(20) << (name.length() > 18 ? name.substr(0, 15) + "..." : name)
                  << setw(15) << customer.billingDate
                  << setw(15) << customer.billAmount << endl;
         }
@@ -567,8 +815,9 @@ void viewPendingBills() {
         if (!customer.isPaid) {
             found = true;
             totalPending += customer.billAmount;
+            string name = customerName(customer);
             cout << left << setw(10) << customer.customerID
-                 << setw(20) << (customer.name.length() > 18 ? customer.name.substr(0, 15) + "..." : customer.name)
+                 << setw(20) << (name.length() > 18 ? name.substr(0, 15) + "..." : name)
                  << setw(15) << customer.billingDate
                  << setw(15) << customer.billAmount << endl;
         }
@@ -605,17 +854,8 @@ void updateTariff() {
         if (newRate < 0) {
             cout << "Rate cannot be negative!\n";
         } else {
-            switch(choice) {
-                case 1:
-                    currentTariff.domesticRate = newRate;
-                    break;
-                case 2:
-                    currentTariff.commercialRate = newRate;
-                    break;
-                case 3:
-                    currentTariff.industrialRate = newRate;
-                    break;
-            }
+            setTariffRate(choice, newRate);
+            recordCommand({"tariff", to_string(choice), formatNumber(newRate)});
             cout << "Tariff rate updated successfully!\n";
         }
     } else if (choice != 0) {
@@ -629,30 +869,17 @@ void generateReport() {
     clearScreen();
     cout << "=== SYSTEM REPORT ===\n\n";
     
-    int totalCustomers = customers.size();
-    int paidBills = 0;
-    int pendingBills = 0;
-    double totalRevenue = 0.0;
-    double totalPending = 0.0;
-    
-    for (const auto &customer : customers) {
-        if (customer.isPaid) {
-            paidBills++;
-            totalRevenue += customer.billAmount;
-        } else {
-            pendingBills++;
-            totalPending += customer.billAmount;
-        }
-    }
+    recordCommand({"report"});
+    ReportTotals totals = computeReportTotals();
     
     cout << "System Statistics:\n";
     cout << "------------------\n";
-    cout << "Total Customers: " << totalCustomers << endl;
-    cout << "Paid Bills: " << paidBills << endl;
-    cout << "Pending Bills: " << pendingBills << endl;
+    cout << "Total Customers: " << customers.size() << endl;
+    cout << "Paid Bills: " << totals.paidBills << endl;
+    cout << "Pending Bills: " << totals.pendingBills << endl;
     cout << fixed << setprecision(2);
-    cout << "Total Revenue Collected: Rs. " << totalRevenue << endl;
-    cout << "Total Pending Amount: Rs. " << totalPending << endl;
+    cout << "Total Revenue Collected: Rs. " << totals.totalRevenue << endl;
+    cout << "Total Pending Amount: Rs. " << totals.totalPending << endl;
     cout << "------------------\n\n";
     
     cout << "Tariff Rates:\n";
@@ -664,204 +891,4784 @@ void generateReport() {
     pressEnterToContinue();
 }
 
-void saveData() {
-    ofstream outFile(DATA_FILE, ios::binary);
-    if (!outFile) {
-        cout << "Error saving data to file!\n";
-        return;
-    }
-    
-    size_t count = customers.size();
-    outFile.write(reinterpret_cast<char*>(&count), sizeof(count));
-    
-    for (const auto &customer : customers) {
-        // Write customer ID
-        outFile.write(reinterpret_cast<const char*>(&customer.customerID), sizeof(customer.customerID));
-        
-        // Write string lengths and strings
-        size_t nameLen = customer.name.length();
-        outFile.write(reinterpret_cast<const char*>(&nameLen), sizeof(nameLen));
-        outFile.write(customer.name.c_str(), nameLen);
-        
-        size_t addrLen = customer.address.length();
-        outFile.write(reinterpret_cast<const char*>(&addrLen), sizeof(addrLen));
-        outFile.write(customer.address.c_str(), addrLen);
-        
-        size_t contactLen = customer.contact.length();
-        outFile.write(reinterpret_cast<const char*>(&contactLen), sizeof(contactLen));
-        outFile.write(customer.contact.c_str(), contactLen);
-        
-        // Write numeric data
-        outFile.write(reinterpret_cast<const char*>(&customer.previousReading), sizeof(customer.previousReading));
-        outFile.write(reinterpret_cast<const char*>(&customer.currentReading), sizeof(customer.currentReading));
-        outFile.write(reinterpret_cast<const char*>(&customer.unitsConsumed), sizeof(customer.unitsConsumed));
-        outFile.write(reinterpret_cast<const char*>(&customer.billAmount), sizeof(customer.billAmount));
-        
-        // Write billing date
-        size_t dateLen = customer.billingDate.length();
-        outFile.write(reinterpret_cast<const char*>(&dateLen), sizeof(dateLen));
-        outFile.write(customer.billingDate.c_str(), dateLen);
-        
-        // Write payment status
-        outFile.write(reinterpret_cast<const char*>(&customer.isPaid), sizeof(customer.isPaid));
-    }
-    
-    outFile.close();
+// ================= Store Operations =================
+// The menu and command replay both change the book through these, so a
+// replayed command does what the interactive one does minus the prompts.
+// The bool results are false when a shared-mode commit was refused.
+
+size_t findCustomer(int id) {
+    auto found = customerIndex.find(id);
+    return found == customerIndex.end() ? CUSTOMER_NOT_FOUND : found->second;
 }
 
-void loadData() {
-    ifstream inFile(DATA_FILE, ios::binary);
-    if (!inFile) {
-        cout << "No existing data found. Starting with empty database.\n";
-        return;
-    }
-    
-    customers.clear();
-    size_t count;
-    inFile.read(reinterpret_cast<char*>(&count), sizeof(count));
-    
-    for (size_t i = 0; i < count; ++i) {
-        Customer customer;
-        
-        // Read customer ID
-        inFile.read(reinterpret_cast<char*>(&customer.customerID), sizeof(customer.customerID));
-        
-        // Read name
-        size_t nameLen;
-        inFile.read(reinterpret_cast<char*>(&nameLen), sizeof(nameLen));
-        char* nameBuffer = new char[nameLen + 1];
-        inFile.read(nameBuffer, nameLen);
-        nameBuffer[nameLen] = '\0';
-        customer.name = nameBuffer;
-        delete[] nameBuffer;
-        
-        // Read address
-        size_t addrLen;
-        inFile.read(reinterpret_cast<char*>(&addrLen), sizeof(addrLen));
-        char* addrBuffer = new char[addrLen + 1];
-        inFile.read(addrBuffer, addrLen);
-        addrBuffer[addrLen] = '\0';
-        customer.address = addrBuffer;
-        delete[] addrBuffer;
-        
-        // Read contact
-        size_t contactLen;
-        inFile.read(reinterpret_cast<char*>(&contactLen), sizeof(contactLen));
-        char* contactBuffer = new char[contactLen + 1];
-        inFile.read(contactBuffer, contactLen);
-        contactBuffer[contactLen] = '\0';
-        customer.contact = contactBuffer;
-        delete[] contactBuffer;
-        
-        // Read numeric data
-        inFile.read(reinterpret_cast<char*>(&customer.previousReading), sizeof(customer.previousReading));
-        inFile.read(reinterpret_cast<char*>(&customer.currentReading), sizeof(customer.currentReading));
-        inFile.read(reinterpret_cast<char*>(&customer.unitsConsumed), sizeof(customer.unitsConsumed));
-        inFile.read(reinterpret_cast<char*>(&customer.billAmount), sizeof(customer.billAmount));
-        
-        // Read billing date
-        size_t dateLen;
-        inFile.read(reinterpret_cast<char*>(&dateLen), sizeof(dateLen));
-        char* dateBuffer = new char[dateLen + 1];
-        inFile.read(dateBuffer, dateLen);
-        dateBuffer[dateLen] = '\0';
-        customer.billingDate = dateBuffer;
-        delete[] dateBuffer;
-        
-        // Read payment status
-        inFile.read(reinterpret_cast<char*>(&customer.isPaid), sizeof(customer.isPaid));
-        
-        customers.push_back(customer);
+// Called whenever the book is replaced wholesale; the operations below
+// keep the index current themselves
+void rebuildCustomerIndex() {
+    customerIndex.clear();
+    customerIndex.reserve(customers.size());
+    for (size_t i = 0; i < customers.size(); ++i) {
+        customerIndex[customers[i].customerID] = i;
     }
-    
-    inFile.close();
-    cout << "Loaded " << customers.size() << " customer records.\n";
 }
 
-void saveTariff() {
-    ofstream outFile(TARIFF_FILE, ios::binary);
-    if (!outFile) {
-        cout << "Error saving tariff data!\n";
-        return;
+// customer.customerID must already be set; issues the first bill
+bool insertCustomer(Customer &customer) {
+    customer.localityID = localityIDFor(customer.address);
+    calculateBill(customer);
+    recordConsumption(customer.unitsConsumed);
+    customers.push_back(customer);
+    customerIndex[customer.customerID] = customers.size() - 1;
+    if (!commitCustomer(customers.size() - 1)) {
+        // The shared store did not take it, so it must not stay local either
+        customerIndex.erase(customer.customerID);
+        customers.pop_back();
+        forgetConsumption();
+        return false;
     }
-    
-    outFile.write(reinterpret_cast<const char*>(&currentTariff), sizeof(currentTariff));
-    outFile.close();
+    return true;
 }
 
-void loadTariff() {
-    ifstream inFile(TARIFF_FILE, ios::binary);
-    if (!inFile) {
-        cout << "No tariff data found. Using default rates.\n";
-        return;
-    }
-    
-    inFile.read(reinterpret_cast<char*>(&currentTariff), sizeof(currentTariff));
-    inFile.close();
+bool billCustomer(size_t index, double currentReading) {
+    Customer &customer = customers[index];
+    customer.previousReading = customer.currentReading;
+    customer.currentReading = currentReading;
+    forgetConsumption();
+    calculateBill(customer);
+    recordConsumption(customer.unitsConsumed);
+    return commitCustomer(index);
 }
 
-string getCurrentDate() {
-    time_t now = time(0);
-    tm* localTime = localtime(&now);
-    
-    stringstream ss;
-    ss << (localTime->tm_year + 1900) << "-"
-       << setw(2) << setfill('0') << (localTime->tm_mon + 1) << "-"
-       << setw(2) << setfill('0') << localTime->tm_mday;
+bool payCustomer(size_t index) {
+    customers[index].isPaid = true;
+    return commitCustomer(index);
+}
+
+// Fields are numbered as in the update menu: 1 name, 2 address, 3 contact,
+// 4 previous reading, 5 current reading, 6 category (1-3). Numeric values
+// must already be validated.
+bool updateCustomerField(size_t index, int field, const string &value) {
+    Customer &customer = customers[index];
+    makeResident(customer);
+    switch (field) {
+        case 1:
+            customer.name = value;
+            break;
+        case 2:
+            customer.address = value;
+            customer.localityID = localityIDFor(value);
+            break;
+        case 3:
+            customer.contact = value;
+            break;
+        case 4:
+            customer.previousReading = strtod(value.c_str(), nullptr);
+            break;
+        case 5:
+            customer.currentReading = strtod(value.c_str(), nullptr);
+            break;
+        case 6:
+            customer.category = atoi(value.c_str()) - 1;
+            break;
+    }
     
-    return ss.str();
+    // Recalculate bill if readings were updated; a new category is only
+    // charged from the next bill, so a paid bill stays paid
+    if (field == 4 || field == 5) {
+        forgetConsumption();
+        calculateBill(customer);
+        recordConsumption(customer.unitsConsumed);
+    }
+    return commitCustomer(index);
 }
 
-int generateCustomerID() {
-    static int lastID = 1000; // Starting ID
-    if (!customers.empty()) {
-        // Find the maximum ID in the existing customers
-        int maxID = 0;
-        for (const auto &customer : customers) {
-            if (customer.customerID > maxID) {
-                maxID = customer.customerID;
-            }
-        }
-        return maxID + 1;
+bool deleteCustomerRecord(size_t index) {
+    if (!commitCustomerDeletion(customers[index].customerID)) {
+        return false;
     }
-    return ++lastID;
+    customerIndex.erase(customers[index].customerID);
+    customers.erase(customers.begin() + index);
+    forgetConsumption();
+    for (size_t i = index; i < customers.size(); ++i) {
+        customerIndex[customers[i].customerID] = i;
+    }
+    return true;
 }
 
-void clearScreen() {
-    // Platform-specific screen clearing
-    #ifdef _WIN32
-        system("cls");
-    #else
-        system("clear");
-    #endif
+// category is 1-3 as in the tariff menu; rate must already be validated
+void setTariffRate(int category, double rate) {
+    switch (category) {
+        case 1:
+            currentTariff.domesticRate = rate;
+            break;
+        case 2:
+            currentTariff.commercialRate = rate;
+            break;
+        case 3:
+            currentTariff.industrialRate = rate;
+            break;
+    }
+    commitTariff();
 }
 
-void pressEnterToContinue() {
-    cout << "\nPress Enter to continue...";
-    cin.ignore(numeric_limits<streamsize>::max(), '\n');
-    cin.get();
+// Case-insensitive substring match on the name
+vector<size_t> searchCustomersByName(const string &part) {
+    string needle = toLowerCopy(part);
+    vector<size_t> matches;
+    ColdFieldReader reader;
+    for (size_t i = 0; i < customers.size(); ++i) {
+        if (toLowerCopy(reader.read(customers[i], COLD_NAME)).find(needle) != string::npos) {
+            matches.push_back(i);
+        }
+    }
+    return matches;
 }
 
-double getValidDouble(const string &prompt) {
-    double value;
-    while (true) {
-        cout << prompt;
-        cin >> value;
-        
-        if (cin.fail() || value < 0) {
-            cin.clear();
-            cin.ignore(numeric_limits<streamsize>::max(), '\n');
-            cout << "Invalid input! Please enter a non-negative number.\n";
+ReportTotals computeReportTotals() {
+    ReportTotals totals = {0, 0, 0.0, 0.0};
+    for (const auto &customer : customers) {
+        if (customer.isPaid) {
+            totals.paidBills++;
+            totals.totalRevenue += customer.billAmount;
         } else {
-            cin.ignore(numeric_limits<streamsize>::max(), '\n');
-            return value;
+            totals.pendingBills++;
+            totals.totalPending += customer.billAmount;
         }
     }
+    return totals;
 }
 
-int getValidInt(const string &prompt) {
-    int value;
-    while (true) {
+// ================= Query Engine =================
+// A query is compiled once into a predicate tree whose leaves are
+// template-instantiated column comparators. Evaluation works on selection
+// vectors (lists of row indices): every node narrows the rows that survived
+// the previous node, and the customer table is split into partitions that
+// are filtered on separate threads.
+//
+//   select id,name,units where units > 500 and pending and date < 2026-09-01 sort units desc limit 20
+
+enum QueryColumn {
+    COL_ID, COL_NAME, COL_ADDRESS, COL_CONTACT, COL_PREVIOUS, COL_CURRENT,
+    COL_UNITS, COL_AMOUNT, COL_DATE, COL_STATUS, COL_DUE_DATE, COL_LATE_FEE, COL_DUNNING,
+    COL_CATEGORY, COL_LOCALITY
+};
+
+enum QueryOp { OP_EQ, OP_NE, OP_LT, OP_LE, OP_GT, OP_GE, OP_CONTAINS };
+
+struct QueryColumnInfo {
+    const char *name;
+    QueryColumn column;
+    int width;
+};
+
+const QueryColumnInfo QUERY_COLUMNS[] = {
+    {"id", COL_ID, 10},
+    {"name", COL_NAME, 20},
+    {"address", COL_ADDRESS, 25},
+    {"contact", COL_CONTACT, 15},
+    {"previous", COL_PREVIOUS, 12},
+    {"current", COL_CURRENT, 12},
+    {"units", COL_UNITS, 12},
+    {"amount", COL_AMOUNT, 12},
+    {"date", COL_DATE, 12},
+    {"status", COL_STATUS, 10},
+    {"due", COL_DUE_DATE, 12},
+    {"latefee", COL_LATE_FEE, 10},
+    {"dunning", COL_DUNNING, 9},
+    {"category", COL_CATEGORY, 12},
+    {"locality", COL_LOCALITY, 15}
+};
+
+// Below this many rows per partition a worker thread costs more than it saves
+const size_t PARTITION_MIN_ROWS = 65536;
+
+size_t partitionCount(size_t total) {
+    size_t workers = thread::hardware_concurrency();
+    return max<size_t>(1, min(workers, total / PARTITION_MIN_ROWS));
+}
+
+// Calls fn(partition, begin, end) for each slice of [0, total), running the
+// first slice on the calling thread and the rest on worker threads
+template <typename Fn>
+void runPartitioned(size_t total, size_t partitions, Fn fn) {
+    vector<thread> threads;
+    for (size_t p = 1; p < partitions; ++p) {
+        threads.emplace_back(fn, p, total * p / partitions, total * (p + 1) / partitions);
+    }
+    fn(0, 0, total / partitions);
+    for (auto &t : threads) {
+        t.join();
+    }
+}
+
+// Column accessors used to instantiate the comparators
+struct IdColumn { double operator()(const Customer &c) const { return c.customerID; } };
+struct PreviousColumn { double operator()(const Customer &c) const { return c.previousReading; } };
+struct CurrentColumn { double operator()(const Customer &c) const { return c.currentReading; } };
+struct UnitsColumn { double operator()(const Customer &c) const { return c.unitsConsumed; } };
+struct AmountColumn { double operator()(const Customer &c) const { return c.billAmount; } };
+struct LateFeeColumn { double operator()(const Customer &c) const { return c.lateFee; } };
+struct DunningColumn { double operator()(const Customer &c) const { return c.dunningLevel; } };
+template <ColdField Field>
+struct TextColumn {
+    ColdFieldReader reader; // one per predicate and partition, so no sharing
+    string operator()(const Customer &c) { return reader.read(c, Field); }
+};
+typedef TextColumn<COLD_NAME> NameColumn;
+typedef TextColumn<COLD_ADDRESS> AddressColumn;
+typedef TextColumn<COLD_CONTACT> ContactColumn;
+struct DateColumn { const string &operator()(const Customer &c) const { return c.billingDate; } };
+struct DueDateColumn { const string &operator()(const Customer &c) const { return c.dueDate; } };
+struct CategoryColumn { string operator()(const Customer &c) const { return CATEGORY_NAMES[c.category]; } };
+struct LocalityColumn { const string &operator()(const Customer &c) const { return localityNames[c.localityID]; } };
+struct StatusColumn { bool operator()(const Customer &c) const { return c.isPaid; } };
+
+// Case-insensitive substring match; the needle is lowercased at compile time
+struct ContainsText {
+    bool operator()(const string &field, const string &needle) const {
+        auto it = search(field.begin(), field.end(), needle.begin(), needle.end(),
+                         [](char a, char b) { return tolower(static_cast<unsigned char>(a)) == b; });
+        return it != field.end() || needle.empty();
+    }
+};
+
+struct QueryNode {
+    virtual ~QueryNode() {}
+    // Keeps only the rows (ascending indices into data) that match
+    virtual void filter(const vector<Customer> &data, vector<size_t> &rows) const = 0;
+};
+
+template <typename Getter, typename Compare, typename Value>
+struct ColumnPredicate : QueryNode {
+    Value value;
+
+    explicit ColumnPredicate(const Value &v) : value(v) {}
+
+    void filter(const vector<Customer> &data, vector<size_t> &rows) const override {
+        Getter get;
+        Compare compare;
+        size_t kept = 0;
+        // Branch-free compaction of the selection vector
+        for (size_t i = 0; i < rows.size(); ++i) {
+            size_t row = rows[i];
+            rows[kept] = row;
+            kept += compare(get(data[row]), value) ? 1 : 0;
+        }
+        rows.resize(kept);
+    }
+};
+
+struct AndNode : QueryNode {
+    unique_ptr<QueryNode> left, right;
+
+    void filter(const vector<Customer> &data, vector<size_t> &rows) const override {
+        left->filter(data, rows);
+        if (!rows.empty()) {
+            right->filter(data, rows);
+        }
+    }
+};
+
+struct OrNode : QueryNode {
+    unique_ptr<QueryNode> left, right;
+
+    void filter(const vector<Customer> &data, vector<size_t> &rows) const override {
+        vector<size_t> matched = rows;
+        left->filter(data, matched);
+
+        // Only rows the left side rejected need to be tried on the right side
+        vector<size_t> rest;
+        rest.reserve(rows.size() - matched.size());
+        set_difference(rows.begin(), rows.end(), matched.begin(), matched.end(), back_inserter(rest));
+        right->filter(data, rest);
+
+        rows.clear();
+        merge(matched.begin(), matched.end(), rest.begin(), rest.end(), back_inserter(rows));
+    }
+};
+
+struct NotNode : QueryNode {
+    unique_ptr<QueryNode> child;
+
+    void filter(const vector<Customer> &data, vector<size_t> &rows) const override {
+        vector<size_t> matched = rows;
+        child->filter(data, matched);
+
+        vector<size_t> rest;
+        rest.reserve(rows.size() - matched.size());
+        set_difference(rows.begin(), rows.end(), matched.begin(), matched.end(), back_inserter(rest));
+        rows.swap(rest);
+    }
+};
+
+struct Query {
+    unique_ptr<QueryNode> filter; // null selects every row
+    vector<QueryColumn> columns;
+    bool sorted;
+    QueryColumn sortColumn;
+    bool descending;
+    size_t limit; // 0 means no limit
+
+    Query() : sorted(false), sortColumn(COL_ID), descending(false), limit(0) {}
+};
+
+enum QueryTokenKind { TOKEN_WORD, TOKEN_STRING, TOKEN_SYMBOL, TOKEN_END };
+
+struct QueryToken {
+    QueryTokenKind kind;
+    string text;
+};
+
+struct QueryParser {
+    vector<QueryToken> tokens;
+    size_t pos;
+    string error;
+
+    QueryParser() : pos(0) {}
+};
+
+string toLowerCopy(string text) {
+    transform(text.begin(), text.end(), text.begin(), ::tolower);
+    return text;
+}
+
+bool tokenizeQuery(const string &text, vector<QueryToken> &tokens, string &error) {
+    size_t i = 0;
+    while (i < text.size()) {
+        char ch = text[i];
+        if (isspace(static_cast<unsigned char>(ch))) {
+            ++i;
+        } else if (ch == '"' || ch == '\'') {
+            size_t end = text.find(ch, i + 1);
+            if (end == string::npos) {
+                error = "Unterminated string literal";
+                return false;
+            }
+            tokens.push_back({TOKEN_STRING, text.substr(i + 1, end - i - 1)});
+            i = end + 1;
+        } else if (ch == '(' || ch == ')' || ch == ',' || ch == '~') {
+            tokens.push_back({TOKEN_SYMBOL, string(1, ch)});
+            ++i;
+        } else if (ch == '=' || ch == '!' || ch == '<' || ch == '>') {
+            string op(1, ch);
+            if (i + 1 < text.size() && text[i + 1] == '=') {
+                op += '=';
+            }
+            if (op == "!") {
+                error = "Unexpected '!'";
+                return false;
+            }
+            tokens.push_back({TOKEN_SYMBOL, op});
+            i += op.size();
+        } else {
+            // Words cover keywords, column names, numbers and dates (2026-09-01)
+            size_t start = i;
+            while (i < text.size() && !isspace(static_cast<unsigned char>(text[i])) &&
+                   string("()~,=!<>\"'").find(text[i]) == string::npos) {
+                ++i;
+            }
+            tokens.push_back({TOKEN_WORD, text.substr(start, i - start)});
+        }
+    }
+    tokens.push_back({TOKEN_END, ""});
+    return true;
+}
+
+const QueryToken &peekToken(const QueryParser &parser) {
+    return parser.tokens[parser.pos];
+}
+
+bool isKeyword(const QueryToken &token, const char *keyword) {
+    return token.kind == TOKEN_WORD && toLowerCopy(token.text) == keyword;
+}
+
+bool acceptKeyword(QueryParser &parser, const char *keyword) {
+    if (isKeyword(peekToken(parser), keyword)) {
+        ++parser.pos;
+        return true;
+    }
+    return false;
+}
+
+bool acceptSymbol(QueryParser &parser, const char *symbol) {
+    const QueryToken &token = peekToken(parser);
+    if (token.kind == TOKEN_SYMBOL && token.text == symbol) {
+        ++parser.pos;
+        return true;
+    }
+    return false;
+}
+
+bool lookupColumn(const string &name, QueryColumn &column) {
+    string key = toLowerCopy(name);
+    if (key == "bill") key = "amount";
+    if (key == "prev") key = "previous";
+    if (key == "curr") key = "current";
+    if (key == "paid") key = "status";
+    for (const auto &info : QUERY_COLUMNS) {
+        if (key == info.name) {
+            column = info.column;
+            return true;
+        }
+    }
+    return false;
+}
+
+const QueryColumnInfo &columnInfo(QueryColumn column) {
+    return QUERY_COLUMNS[column];
+}
+
+template <typename Getter, typename Value>
+unique_ptr<QueryNode> makeComparison(QueryOp op, const Value &value) {
+    switch (op) {
+        case OP_EQ: return unique_ptr<QueryNode>(new ColumnPredicate<Getter, equal_to<>, Value>(value));
+        case OP_NE: return unique_ptr<QueryNode>(new ColumnPredicate<Getter, not_equal_to<>, Value>(value));
+        case OP_LT: return unique_ptr<QueryNode>(new ColumnPredicate<Getter, less<>, Value>(value));
+        case OP_LE: return unique_ptr<QueryNode>(new ColumnPredicate<Getter, less_equal<>, Value>(value));
+        case OP_GT: return unique_ptr<QueryNode>(new ColumnPredicate<Getter, greater<>, Value>(value));
+        case OP_GE: return unique_ptr<QueryNode>(new ColumnPredicate<Getter, greater_equal<>, Value>(value));
+        default: return nullptr;
+    }
+}
+
+template <typename Getter>
+unique_ptr<QueryNode> makeTextComparison(QueryOp op, const string &value) {
+    if (op == OP_CONTAINS) {
+        return unique_ptr<QueryNode>(new ColumnPredicate<Getter, ContainsText, string>(toLowerCopy(value)));
+    }
+    return makeComparison<Getter, string>(op, value);
+}
+
+unique_ptr<QueryNode> makeColumnPredicate(QueryColumn column, QueryOp op, const string &literal, string &error) {
+    if (column == COL_STATUS) {
+        string status = toLowerCopy(literal);
+        if ((op != OP_EQ && op != OP_NE) || (status != "paid" && status != "pending")) {
+            error = "status only supports = or != with paid/pending";
+            return nullptr;
+        }
+        bool paid = (status == "paid");
+        return makeComparison<StatusColumn, bool>(op, paid);
+    }
+
+    switch (column) {
+        case COL_NAME: return makeTextComparison<NameColumn>(op, literal);
+        case COL_ADDRESS: return makeTextComparison<AddressColumn>(op, literal);
+        case COL_CONTACT: return makeTextComparison<ContactColumn>(op, literal);
+        case COL_DATE: return makeTextComparison<DateColumn>(op, literal);
+        case COL_DUE_DATE: return makeTextComparison<DueDateColumn>(op, literal);
+        case COL_CATEGORY: return makeTextComparison<CategoryColumn>(op, literal);
+        case COL_LOCALITY: return makeTextComparison<LocalityColumn>(op, literal);
+        default: break;
+    }
+
+    if (op == OP_CONTAINS) {
+        error = string("'~' is not supported on numeric column ") + columnInfo(column).name;
+        return nullptr;
+    }
+
+    char *end = nullptr;
+    double number = strtod(literal.c_str(), &end);
+    if (literal.empty() || *end != '\0') {
+        error = string("Column ") + columnInfo(column).name + " expects a number, got '" + literal + "'";
+        return nullptr;
+    }
+
+    switch (column) {
+        case COL_ID: return makeComparison<IdColumn, double>(op, number);
+        case COL_PREVIOUS: return makeComparison<PreviousColumn, double>(op, number);
+        case COL_CURRENT: return makeComparison<CurrentColumn, double>(op, number);
+        case COL_UNITS: return makeComparison<UnitsColumn, double>(op, number);
+        case COL_LATE_FEE: return makeComparison<LateFeeColumn, double>(op, number);
+        case COL_DUNNING: return makeComparison<DunningColumn, double>(op, number);
+        default: return makeComparison<AmountColumn, double>(op, number);
+    }
+}
+
+unique_ptr<QueryNode> parseOrExpression(QueryParser &parser);
+
+unique_ptr<QueryNode> parseUnaryExpression(QueryParser &parser) {
+    if (acceptKeyword(parser, "not")) {
+        unique_ptr<QueryNode> child = parseUnaryExpression(parser);
+        if (!child) return nullptr;
+        unique_ptr<NotNode> node(new NotNode);
+        node->child = move(child);
+        return node;
+    }
+
+    if (acceptSymbol(parser, "(")) {
+        unique_ptr<QueryNode> inner = parseOrExpression(parser);
+        if (!inner) return nullptr;
+        if (!acceptSymbol(parser, ")")) {
+            parser.error = "Expected ')'";
+            return nullptr;
+        }
+        return inner;
+    }
+
+    // Shorthand for status = paid / status = pending
+    if (acceptKeyword(parser, "paid")) {
+        return makeColumnPredicate(COL_STATUS, OP_EQ, "paid", parser.error);
+    }
+    if (acceptKeyword(parser, "pending")) {
+        return makeColumnPredicate(COL_STATUS, OP_EQ, "pending", parser.error);
+    }
+
+    const QueryToken &columnToken = peekToken(parser);
+    QueryColumn column;
+    if (columnToken.kind != TOKEN_WORD || !lookupColumn(columnToken.text, column)) {
+        parser.error = "Unknown column '" + columnToken.text + "'";
+        return nullptr;
+    }
+    ++parser.pos;
+
+    const QueryToken &opToken = peekToken(parser);
+    QueryOp op;
+    if (opToken.kind != TOKEN_SYMBOL) {
+        parser.error = "Expected a comparison after '" + columnToken.text + "'";
+        return nullptr;
+    }
+    if (opToken.text == "=" || opToken.text == "==") op = OP_EQ;
+    else if (opToken.text == "!=") op = OP_NE;
+    else if (opToken.text == "<") op = OP_LT;
+    else if (opToken.text == "<=") op = OP_LE;
+    else if (opToken.text == ">") op = OP_GT;
+    else if (opToken.text == ">=") op = OP_GE;
+    else if (opToken.text == "~") op = OP_CONTAINS;
+    else {
+        parser.error = "Unexpected '" + opToken.text + "'";
+        return nullptr;
+    }
+    ++parser.pos;
+
+    const QueryToken &valueToken = peekToken(parser);
+    if (valueToken.kind != TOKEN_WORD && valueToken.kind != TOKEN_STRING) {
+        parser.error = "Expected a value after '" + opToken.text + "'";
+        return nullptr;
+    }
+    ++parser.pos;
+
+    return makeColumnPredicate(column, op, valueToken.text, parser.error);
+}
+
+unique_ptr<QueryNode> parseAndExpression(QueryParser &parser) {
+    unique_ptr<QueryNode> left = parseUnaryExpression(parser);
+    while (left && acceptKeyword(parser, "and")) {
+        unique_ptr<QueryNode> right = parseUnaryExpression(parser);
+        if (!right) return nullptr;
+        unique_ptr<AndNode> node(new AndNode);
+        node->left = move(left);
+        node->right = move(right);
+        left = move(node);
+    }
+    return left;
+}
+
+unique_ptr<QueryNode> parseOrExpression(QueryParser &parser) {
+    unique_ptr<QueryNode> left = parseAndExpression(parser);
+    while (left && acceptKeyword(parser, "or")) {
+        unique_ptr<QueryNode> right = parseAndExpression(parser);
+        if (!right) return nullptr;
+        unique_ptr<OrNode> node(new OrNode);
+        node->left = move(left);
+        node->right = move(right);
+        left = move(node);
+    }
+    return left;
+}
+
+bool parseColumnName(QueryParser &parser, QueryColumn &column) {
+    const QueryToken &token = peekToken(parser);
+    if (token.kind != TOKEN_WORD || !lookupColumn(token.text, column)) {
+        parser.error = "Unknown column '" + token.text + "'";
+        return false;
+    }
+    ++parser.pos;
+    return true;
+}
+
+// Grammar: [select col,...] [where] [expr] [sort [by] col [asc|desc]] [limit n]
+bool compileQuery(const string &text, Query &query, string &error) {
+    QueryParser parser;
+    if (!tokenizeQuery(text, parser.tokens, error)) {
+        return false;
+    }
+
+    if (acceptKeyword(parser, "select")) {
+        do {
+            QueryColumn column;
+            if (!parseColumnName(parser, column)) {
+                error = parser.error;
+                return false;
+            }
+            query.columns.push_back(column);
+        } while (acceptSymbol(parser, ","));
+    }
+
+    acceptKeyword(parser, "where");
+    const QueryToken &next = peekToken(parser);
+    if (next.kind != TOKEN_END && !isKeyword(next, "sort") && !isKeyword(next, "order") && !isKeyword(next, "limit")) {
+        query.filter = parseOrExpression(parser);
+        if (!query.filter) {
+            error = parser.error;
+            return false;
+        }
+    }
+
+    if (acceptKeyword(parser, "sort") || acceptKeyword(parser, "order")) {
+        acceptKeyword(parser, "by");
+        if (!parseColumnName(parser, query.sortColumn)) {
+            error = parser.error;
+            return false;
+        }
+        query.sorted = true;
+        if (acceptKeyword(parser, "desc")) {
+            query.descending = true;
+        } else {
+            acceptKeyword(parser, "asc");
+        }
+    }
+
+    if (acceptKeyword(parser, "limit")) {
+        const QueryToken &token = peekToken(parser);
+        char *end = nullptr;
+        long limit = strtol(token.text.c_str(), &end, 10);
+        if (token.kind != TOKEN_WORD || *end != '\0' || limit <= 0) {
+            error = "limit expects a positive whole number";
+            return false;
+        }
+        query.limit = static_cast<size_t>(limit);
+        ++parser.pos;
+    }
+
+    if (peekToken(parser).kind != TOKEN_END) {
+        error = "Unexpected '" + peekToken(parser).text + "'";
+        return false;
+    }
+
+    if (query.columns.empty()) {
+        query.columns = {COL_ID, COL_NAME, COL_CONTACT, COL_UNITS, COL_AMOUNT, COL_STATUS};
+    }
+    return true;
+}
+
+// Text columns that may be on disk are sorted on keys fetched up front
+bool isColdColumn(QueryColumn column, ColdField &field) {
+    switch (column) {
+        case COL_NAME: field = COLD_NAME; return true;
+        case COL_ADDRESS: field = COLD_ADDRESS; return true;
+        case COL_CONTACT: field = COLD_CONTACT; return true;
+        default: return false;
+    }
+}
+
+int compareByColumn(const Customer &a, const Customer &b, QueryColumn column) {
+    switch (column) {
+        case COL_ID: return (a.customerID > b.customerID) - (a.customerID < b.customerID);
+        case COL_NAME: return customerName(a).compare(customerName(b));
+        case COL_ADDRESS: return customerAddress(a).compare(customerAddress(b));
+        case COL_CONTACT: return customerContact(a).compare(customerContact(b));
+        case COL_PREVIOUS: return (a.previousReading > b.previousReading) - (a.previousReading < b.previousReading);
+        case COL_CURRENT: return (a.currentReading > b.currentReading) - (a.currentReading < b.currentReading);
+        case COL_UNITS: return (a.unitsConsumed > b.unitsConsumed) - (a.unitsConsumed < b.unitsConsumed);
+        case COL_AMOUNT: return (a.billAmount > b.billAmount) - (a.billAmount < b.billAmount);
+        case COL_DATE: return a.billingDate.compare(b.billingDate);
+        case COL_STATUS: return static_cast<int>(a.isPaid) - static_cast<int>(b.isPaid);
+        case COL_DUE_DATE: return a.dueDate.compare(b.dueDate);
+        case COL_LATE_FEE: return (a.lateFee > b.lateFee) - (a.lateFee < b.lateFee);
+        case COL_DUNNING: return a.dunningLevel - b.dunningLevel;
+        case COL_CATEGORY: return a.category - b.category;
+        case COL_LOCALITY: return localityNames[a.localityID].compare(localityNames[b.localityID]);
+    }
+    return 0;
+}
+
+vector<size_t> executeQuery(const Query &query, const vector<Customer> &data) {
+    size_t workers = partitionCount(data.size());
+    vector<vector<size_t>> partitions(workers);
+    runPartitioned(data.size(), workers, [&](size_t p, size_t begin, size_t end) {
+        vector<size_t> &rows = partitions[p];
+        rows.resize(end - begin);
+        iota(rows.begin(), rows.end(), begin);
+        if (query.filter) {
+            query.filter->filter(data, rows);
+        }
+    });
+
+    vector<size_t> rows;
+    if (workers == 1) {
+        rows.swap(partitions[0]);
+    } else {
+        size_t matched = 0;
+        for (const auto &part : partitions) matched += part.size();
+        rows.reserve(matched);
+        for (const auto &part : partitions) rows.insert(rows.end(), part.begin(), part.end());
+    }
+
+    if (query.sorted) {
+        // Fetching a text field can mean a cache lookup or a block read, so
+        // each row's key is fetched once rather than twice per comparison.
+        // The positions in `rows` are sorted; rows are ascending, so ties
+        // fall back to table order and results are deterministic.
+        ColdField field;
+        vector<string> keys;
+        if (isColdColumn(query.sortColumn, field)) {
+            keys.resize(rows.size());
+            runPartitioned(rows.size(), partitionCount(rows.size()), [&](size_t, size_t begin, size_t end) {
+                ColdFieldReader reader;
+                for (size_t i = begin; i < end; ++i) {
+                    keys[i] = reader.read(data[rows[i]], field);
+                }
+            });
+        }
+        auto before = [&](size_t a, size_t b) {
+            int cmp = keys.empty() ? compareByColumn(data[rows[a]], data[rows[b]], query.sortColumn)
+                                   : keys[a].compare(keys[b]);
+            if (cmp != 0) return query.descending ? cmp > 0 : cmp < 0;
+            return a < b;
+        };
+        vector<size_t> order(rows.size());
+        iota(order.begin(), order.end(), 0);
+        if (query.limit > 0 && query.limit < order.size()) {
+            partial_sort(order.begin(), order.begin() + query.limit, order.end(), before);
+            order.resize(query.limit);
+        } else {
+            sort(order.begin(), order.end(), before);
+        }
+        for (size_t &position : order) {
+            position = rows[position];
+        }
+        rows.swap(order);
+    }
+
+    if (query.limit > 0 && query.limit < rows.size()) {
+        rows.resize(query.limit);
+    }
+    return rows;
+}
+
+void printQueryCell(const Customer &customer, QueryColumn column) {
+    int width = columnInfo(column).width;
+    string text;
+    switch (column) {
+        case COL_NAME: text = customerName(customer); break;
+        case COL_ADDRESS: text = customerAddress(customer); break;
+        case COL_CONTACT: text = customerContact(customer); break;
+        case COL_DATE: text = customer.billingDate; break;
+        case COL_STATUS: text = customer.isPaid ? "PAID" : "PENDING"; break;
+        case COL_DUE_DATE: text = customer.dueDate; break;
+        case COL_CATEGORY: text = CATEGORY_NAMES[customer.category]; break;
+        case COL_LOCALITY: text = localityNames[customer.localityID]; break;
+        case COL_ID: cout << setw(width) << customer.customerID; return;
+        case COL_DUNNING: cout << setw(width) << customer.dunningLevel; return;
+        case COL_LATE_FEE: cout << setw(width) << customer.lateFee; return;
+        case COL_PREVIOUS: cout << setw(width) << customer.previousReading; return;
+        case COL_CURRENT: cout << setw(width) << customer.currentReading; return;
+        case COL_UNITS: cout << setw(width) << customer.unitsConsumed; return;
+        case COL_AMOUNT: cout << setw(width) << customer.billAmount; return;
+    }
+    if (static_cast<int>(text.length()) > width - 2) {
+        text = text.substr(0, width - 5) + "...";
+    }
+    cout << setw(width) << text;
+}
+
+void queryCustomers() {
+    clearScreen();
+    cout << "=== QUERY CUSTOMERS ===\n\n";
+
+    if (customers.empty()) {
+        cout << "No customers found!\n";
+        pressEnterToContinue();
+        return;
+    }
+
+    cout << "Columns: id, name, address, contact, previous, current, units, amount, date, status,\n";
+    cout << "         due, latefee, dunning, category, locality\n";
+    cout << "Operators: = != < <= > >= ~ (contains), and, or, not, paid, pending\n";
+    cout << "Example: select id,name,units where units > 500 and pending and date < 2026-09-01 sort units desc limit 20\n\n";
+
+    string text;
+    cout << "Enter query: ";
+    getline(cin, text);
+
+    Query query;
+    string error;
+    if (!compileQuery(text, query, error)) {
+        cout << "Invalid query: " << error << endl;
+        pressEnterToContinue();
+        return;
+    }
+
+    auto start = chrono::steady_clock::now();
+    vector<size_t> rows = executeQuery(query, customers);
+    double elapsedMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    cout << endl << left;
+    int lineWidth = 0;
+    for (QueryColumn column : query.columns) {
+        cout << setw(columnInfo(column).width) << columnInfo(column).name;
+        lineWidth += columnInfo(column).width;
+    }
+    cout << endl << string(lineWidth, '-') << endl;
+
+    cout << fixed << setprecision(2);
+    for (size_t row : rows) {
+        for (QueryColumn column : query.columns) {
+            printQueryCell(customers[row], column);
+        }
+        cout << endl;
+    }
+
+    cout << string(lineWidth, '-') << endl;
+    cout << rows.size() << " matching customer(s) in " << elapsedMs << " ms\n";
+
+    pressEnterToContinue();
+}
+
+// ================= Invoice Rendering =================
+// Invoice templates are compiled once into literal and field segments.
+// Month-end printing renders invoices with to_chars into a per-thread
+// buffer and writes each shard file in large sequential chunks.
+// Template placeholders use the query column names, e.g. {{name}}, {{amount}}.
+
+const string INVOICE_DIR = "invoices";
+const size_t INVOICE_FLUSH_BYTES = 4 << 20;
+
+const char *const DEFAULT_INVOICE_TEMPLATE =
+    "=========================================\n"
+    "        ELECTRICITY BILL\n"
+    "=========================================\n"
+    "Bill Date: {{date}}\n"
+    "Due Date: {{due}}\n"
+    "Customer ID: {{id}}\n"
+    "Customer Name: {{name}}\n"
+    "Address: {{address}}\n"
+    "Contact: {{contact}}\n"
+    "Tariff Category: {{category}}\n"
+    "-----------------------------------------\n"
+    "Previous Reading: {{previous}} units\n"
+    "Current Reading: {{current}} units\n"
+    "Units Consumed: {{units}} units\n"
+    "-----------------------------------------\n"
+    "Late Fee: Rs. {{latefee}}\n"
+    "Bill Amount: Rs. {{amount}}\n"
+    "Payment Status: {{status}}\n"
+    "=========================================\n";
+
+struct InvoiceSegment {
+    bool isField;
+    QueryColumn column;
+    string literal;
+};
+
+struct InvoiceTemplate {
+    vector<InvoiceSegment> segments;
+    bool html;
+
+    InvoiceTemplate() : html(false) {}
+};
+
+struct InvoiceShardResult {
+    size_t pages;
+    size_t bytes;
+    bool ok;
+
+    InvoiceShardResult() : pages(0), bytes(0), ok(true) {}
+};
+
+bool compileInvoiceTemplate(const string &text, bool html, InvoiceTemplate &tmpl, string &error) {
+    tmpl.segments.clear();
+    tmpl.html = html;
+
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t open = text.find("{{", pos);
+        if (open == string::npos) {
+            tmpl.segments.push_back({false, COL_ID, text.substr(pos)});
+            break;
+        }
+        if (open > pos) {
+            tmpl.segments.push_back({false, COL_ID, text.substr(pos, open - pos)});
+        }
+
+        size_t close = text.find("}}", open + 2);
+        if (close == string::npos) {
+            error = "Unterminated placeholder at offset " + to_string(open);
+            return false;
+        }
+
+        string name = text.substr(open + 2, close - open - 2);
+        name.erase(0, name.find_first_not_of(" \t"));
+        name.erase(name.find_last_not_of(" \t") + 1);
+
+        QueryColumn column;
+        if (!lookupColumn(name, column)) {
+            error = "Unknown placeholder {{" + name + "}}";
+            return false;
+        }
+        tmpl.segments.push_back({true, column, ""});
+        pos = close + 2;
+    }
+    return true;
+}
+
+void appendInvoiceNumber(string &out, double value) {
+    char buffer[64];
+    auto result = to_chars(buffer, buffer + sizeof(buffer), value, chars_format::fixed, 2);
+    out.append(buffer, result.ptr);
+}
+
+void appendInvoiceText(string &out, const string &text, bool html) {
+    if (!html) {
+        out += text;
+        return;
+    }
+    for (char ch : text) {
+        switch (ch) {
+            case '&': out += "&amp;"; break;
+            case '<': out += "&lt;"; break;
+            case '>': out += "&gt;"; break;
+            case '"': out += "&quot;"; break;
+            default: out += ch;
+        }
+    }
+}
+
+void renderInvoice(const InvoiceTemplate &tmpl, const Customer &customer, string &out,
+                   ColdFieldReader &reader) {
+    for (const auto &segment : tmpl.segments) {
+        if (!segment.isField) {
+            out += segment.literal;
+            continue;
+        }
+        switch (segment.column) {
+            case COL_ID:
+            case COL_DUNNING: {
+                char buffer[16];
+                int value = segment.column == COL_ID ? customer.customerID : customer.dunningLevel;
+                auto result = to_chars(buffer, buffer + sizeof(buffer), value);
+                out.append(buffer, result.ptr);
+                break;
+            }
+            case COL_NAME: appendInvoiceText(out, reader.read(customer, COLD_NAME), tmpl.html); break;
+            case COL_ADDRESS: appendInvoiceText(out, reader.read(customer, COLD_ADDRESS), tmpl.html); break;
+            case COL_CONTACT: appendInvoiceText(out, reader.read(customer, COLD_CONTACT), tmpl.html); break;
+            case COL_DATE: appendInvoiceText(out, customer.billingDate, tmpl.html); break;
+            case COL_DUE_DATE: appendInvoiceText(out, customer.dueDate, tmpl.html); break;
+            case COL_LATE_FEE: appendInvoiceNumber(out, customer.lateFee); break;
+            case COL_CATEGORY: out += CATEGORY_NAMES[customer.category]; break;
+            case COL_LOCALITY: appendInvoiceText(out, localityNames[customer.localityID], tmpl.html); break;
+            case COL_STATUS: out += customer.isPaid ? "PAID" : "PENDING"; break;
+            case COL_PREVIOUS: appendInvoiceNumber(out, customer.previousReading); break;
+            case COL_CURRENT: appendInvoiceNumber(out, customer.currentReading); break;
+            case COL_UNITS: appendInvoiceNumber(out, customer.unitsConsumed); break;
+            case COL_AMOUNT: appendInvoiceNumber(out, customer.billAmount); break;
+        }
+    }
+}
+
+string renderBillText(const Customer &customer) {
+    static InvoiceTemplate defaultTemplate;
+    if (defaultTemplate.segments.empty()) {
+        string error;
+        compileInvoiceTemplate(DEFAULT_INVOICE_TEMPLATE, false, defaultTemplate, error);
+    }
+
+    string out;
+    ColdFieldReader reader;
+    renderInvoice(defaultTemplate, customer, out, reader);
+    return out;
+}
+
+bool flushInvoiceBuffer(FILE *file, string &buffer, InvoiceShardResult &result) {
+    if (buffer.empty()) {
+        return true;
+    }
+    if (fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size()) {
+        return false;
+    }
+    result.bytes += buffer.size();
+    buffer.clear();
+    return true;
+}
+
+void renderInvoiceShard(const InvoiceTemplate &tmpl, size_t begin, size_t end,
+                        const string &path, InvoiceShardResult &result) {
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file) {
+        result.ok = false;
+        return;
+    }
+    // Writes are already batched into large chunks, so skip stdio buffering
+    setvbuf(file, nullptr, _IONBF, 0);
+
+    string buffer;
+    buffer.reserve(INVOICE_FLUSH_BYTES + 64 * 1024);
+    if (tmpl.html) {
+        buffer += "<!DOCTYPE html>\n<html>\n<body>\n";
+    }
+
+    // Shard rows are consecutive, so one reader covers a whole text block
+    ColdFieldReader reader;
+    for (size_t i = begin; i < end && result.ok; ++i) {
+        renderInvoice(tmpl, customers[i], buffer, reader);
+        result.pages++;
+        if (buffer.size() >= INVOICE_FLUSH_BYTES) {
+            result.ok = flushInvoiceBuffer(file, buffer, result);
+        }
+    }
+
+    if (tmpl.html) {
+        buffer += "</body>\n</html>\n";
+    }
+    if (result.ok) {
+        result.ok = flushInvoiceBuffer(file, buffer, result);
+    }
+    if (fclose(file) != 0) {
+        result.ok = false;
+    }
+}
+
+void printAllInvoices() {
+    clearScreen();
+    cout << "=== PRINT ALL INVOICES ===\n\n";
+
+    if (customers.empty()) {
+        cout << "No customers found!\n";
+        pressEnterToContinue();
+        return;
+    }
+
+    string templatePath;
+    cout << "Template file (.txt or .html, leave blank for the built-in invoice): ";
+    getline(cin, templatePath);
+
+    string templateText = DEFAULT_INVOICE_TEMPLATE;
+    bool html = false;
+    if (!templatePath.empty()) {
+        ifstream inFile(templatePath, ios::binary);
+        if (!inFile) {
+            cout << "Could not open template file: " << templatePath << endl;
+            pressEnterToContinue();
+            return;
+        }
+        stringstream contents;
+        contents << inFile.rdbuf();
+        templateText = contents.str();
+
+        string extension = toLowerCopy(filesystem::path(templatePath).extension().string());
+        html = (extension == ".html" || extension == ".htm");
+    }
+
+    InvoiceTemplate tmpl;
+    string error;
+    if (!compileInvoiceTemplate(templateText, html, tmpl, error)) {
+        cout << "Invalid template: " << error << endl;
+        pressEnterToContinue();
+        return;
+    }
+
+    size_t shards = getValidInt("Number of output shards (0 = one per CPU): ");
+    size_t cpus = max<size_t>(1, thread::hardware_concurrency());
+    if (shards == 0) {
+        shards = cpus;
+    }
+    shards = min(shards, customers.size());
+
+    error_code ec;
+    filesystem::create_directories(INVOICE_DIR, ec);
+    if (ec) {
+        cout << "Could not create directory " << INVOICE_DIR << ": " << ec.message() << endl;
+        pressEnterToContinue();
+        return;
+    }
+    // Drop shards from an earlier run so the directory matches this run
+    for (const auto &entry : filesystem::directory_iterator(INVOICE_DIR, ec)) {
+        if (entry.path().filename().string().rfind("invoices_", 0) == 0) {
+            filesystem::remove(entry.path(), ec);
+        }
+    }
+
+    vector<InvoiceShardResult> results(shards);
+    vector<string> paths(shards);
+    for (size_t s = 0; s < shards; ++s) {
+        ostringstream name;
+        name << INVOICE_DIR << "/invoices_" << setw(3) << setfill('0') << s << (html ? ".html" : ".txt");
+        paths[s] = name.str();
+    }
+
+    auto start = chrono::steady_clock::now();
+
+    // Workers pull whole shards so each file is written by a single thread
+    atomic<size_t> nextShard(0);
+    auto worker = [&]() {
+        for (size_t s = nextShard++; s < shards; s = nextShard++) {
+            size_t begin = customers.size() * s / shards;
+            size_t end = customers.size() * (s + 1) / shards;
+            renderInvoiceShard(tmpl, begin, end, paths[s], results[s]);
+        }
+    };
+
+    vector<thread> threads;
+    for (size_t t = 1; t < min(shards, cpus); ++t) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    size_t pages = 0;
+    size_t bytes = 0;
+    bool ok = true;
+    for (size_t s = 0; s < shards; ++s) {
+        pages += results[s].pages;
+        bytes += results[s].bytes;
+        if (!results[s].ok) {
+            ok = false;
+            cout << "Error writing " << paths[s] << endl;
+        }
+    }
+
+    cout << fixed << setprecision(2);
+    cout << "\nInvoices written: " << pages << " in " << shards << " file(s) under " << INVOICE_DIR << "/\n";
+    cout << "Output size: " << bytes / (1024.0 * 1024.0) << " MB\n";
+    cout << "Elapsed: " << seconds << " s\n";
+    if (seconds > 0) {
+        cout << "Throughput: " << pages / seconds << " pages/sec, "
+             << bytes / (1024.0 * 1024.0) / seconds << " MB/sec\n";
+    }
+    if (!ok) {
+        cout << "Some invoice files could not be written completely.\n";
+    }
+
+    pressEnterToContinue();
+}
+
+// ================= Group-By Aggregation =================
+// Rolls consumption and revenue up by locality, tariff category and billing
+// month. Every partition fills a thread-local hash aggregate keyed by a
+// packed group key; the partials are merged, and the subtotal levels of the
+// rollup are derived from the merged groups instead of rescanning customers.
+
+enum GroupDimension { GROUP_LOCALITY, GROUP_CATEGORY, GROUP_MONTH, GROUP_DIMENSION_COUNT };
+
+const char *const GROUP_DIMENSION_NAMES[GROUP_DIMENSION_COUNT] = {"locality", "category", "month"};
+const int GROUP_DIMENSION_WIDTHS[GROUP_DIMENSION_COUNT] = {18, 12, 10};
+
+// Layout of the packed 64-bit key; a part with all bits set means "ALL"
+const int GROUP_KEY_SHIFT[GROUP_DIMENSION_COUNT] = {0, 32, 40};
+const uint64_t GROUP_KEY_MASK[GROUP_DIMENSION_COUNT] = {0xFFFFFFFFULL, 0xFFULL, 0xFFFFFFULL};
+const uint64_t GROUP_KEY_ALL = ~0ULL;
+
+struct GroupAggregate {
+    size_t count;
+    double unitsSum, unitsMin, unitsMax;
+    double amountSum, amountMin, amountMax;
+
+    GroupAggregate() : count(0),
+                       unitsSum(0.0), unitsMin(numeric_limits<double>::max()), unitsMax(numeric_limits<double>::lowest()),
+                       amountSum(0.0), amountMin(numeric_limits<double>::max()), amountMax(numeric_limits<double>::lowest()) {}
+
+    void add(const Customer &customer) {
+        count++;
+        unitsSum += customer.unitsConsumed;
+        unitsMin = min(unitsMin, customer.unitsConsumed);
+        unitsMax = max(unitsMax, customer.unitsConsumed);
+        amountSum += customer.billAmount;
+        amountMin = min(amountMin, customer.billAmount);
+        amountMax = max(amountMax, customer.billAmount);
+    }
+
+    void merge(const GroupAggregate &other) {
+        count += other.count;
+        unitsSum += other.unitsSum;
+        unitsMin = min(unitsMin, other.unitsMin);
+        unitsMax = max(unitsMax, other.unitsMax);
+        amountSum += other.amountSum;
+        amountMin = min(amountMin, other.amountMin);
+        amountMax = max(amountMax, other.amountMax);
+    }
+};
+
+typedef unordered_map<uint64_t, GroupAggregate> GroupTable;
+
+uint64_t groupKeyPart(uint64_t key, int dimension) {
+    return (key >> GROUP_KEY_SHIFT[dimension]) & GROUP_KEY_MASK[dimension];
+}
+
+bool isRolledUp(uint64_t key, int dimension) {
+    return groupKeyPart(key, dimension) == GROUP_KEY_MASK[dimension];
+}
+
+// Months are numbered year * 12 + (month - 1); 0 stands for an unknown date
+uint64_t billingMonth(const string &date) {
+    if (date.size() < 7 || date[4] != '-') {
+        return 0;
+    }
+    int year = atoi(date.substr(0, 4).c_str());
+    int month = atoi(date.substr(5, 2).c_str());
+    if (year <= 0 || month < 1 || month > 12) {
+        return 0;
+    }
+    return year * 12 + (month - 1);
+}
+
+uint64_t groupKeyFor(const Customer &customer, const vector<int> &dimensions) {
+    uint64_t key = GROUP_KEY_ALL;
+    for (int dimension : dimensions) {
+        uint64_t value = 0;
+        switch (dimension) {
+            case GROUP_LOCALITY: value = customer.localityID; break;
+            case GROUP_CATEGORY: value = customer.category; break;
+            case GROUP_MONTH: value = billingMonth(customer.billingDate); break;
+        }
+        key &= ~(GROUP_KEY_MASK[dimension] << GROUP_KEY_SHIFT[dimension]);
+        key |= value << GROUP_KEY_SHIFT[dimension];
+    }
+    return key;
+}
+
+// Returns the finest groups plus a subtotal row for every prefix of the
+// dimension list, ending with the grand total
+GroupTable rollupCustomers(const vector<int> &dimensions) {
+    size_t workers = partitionCount(customers.size());
+    vector<GroupTable> partials(workers);
+    runPartitioned(customers.size(), workers, [&](size_t p, size_t begin, size_t end) {
+        GroupTable &groups = partials[p];
+        for (size_t i = begin; i < end; ++i) {
+            groups[groupKeyFor(customers[i], dimensions)].add(customers[i]);
+        }
+    });
+
+    GroupTable result;
+    result.swap(partials[0]);
+    for (size_t p = 1; p < workers; ++p) {
+        for (const auto &group : partials[p]) {
+            result[group.first].merge(group.second);
+        }
+    }
+
+    GroupTable subtotals;
+    for (const auto &group : result) {
+        uint64_t key = group.first;
+        for (size_t level = dimensions.size(); level-- > 0; ) {
+            int dimension = dimensions[level];
+            key |= GROUP_KEY_MASK[dimension] << GROUP_KEY_SHIFT[dimension];
+            subtotals[key].merge(group.second);
+        }
+    }
+    if (dimensions.empty()) {
+        return result;
+    }
+    for (const auto &subtotal : subtotals) {
+        result[subtotal.first] = subtotal.second;
+    }
+    return result;
+}
+
+string groupLabel(uint64_t key, int dimension) {
+    if (isRolledUp(key, dimension)) {
+        return "ALL";
+    }
+    uint64_t value = groupKeyPart(key, dimension);
+    switch (dimension) {
+        case GROUP_LOCALITY:
+            return value < localityNames.size() ? localityNames[value] : "Unknown";
+        case GROUP_CATEGORY:
+            return value < CATEGORY_COUNT ? CATEGORY_NAMES[value] : "Unknown";
+        default: {
+            if (value == 0) {
+                return "Unknown";
+            }
+            ostringstream label;
+            label << value / 12 << "-" << setw(2) << setfill('0') << value % 12 + 1;
+            return label.str();
+        }
+    }
+}
+
+// Orders rows dimension by dimension, with each subtotal after its members
+bool groupRowBefore(uint64_t a, uint64_t b, const vector<int> &dimensions) {
+    for (int dimension : dimensions) {
+        bool allA = isRolledUp(a, dimension);
+        bool allB = isRolledUp(b, dimension);
+        if (allA != allB) {
+            return allB;
+        }
+        if (allA) {
+            continue;
+        }
+        uint64_t valueA = groupKeyPart(a, dimension);
+        uint64_t valueB = groupKeyPart(b, dimension);
+        if (valueA == valueB) {
+            continue;
+        }
+        if (dimension == GROUP_LOCALITY) {
+            return groupLabel(a, dimension) < groupLabel(b, dimension);
+        }
+        return valueA < valueB;
+    }
+    return false;
+}
+
+void generateGroupReport() {
+    clearScreen();
+    cout << "=== GROUP-BY REPORT ===\n\n";
+
+    if (customers.empty()) {
+        cout << "No customers found!\n";
+        pressEnterToContinue();
+        return;
+    }
+
+    string text;
+    cout << "Group by any of locality, category, month (comma-separated, blank for all three): ";
+    getline(cin, text);
+    if (text.find_first_not_of(" \t") == string::npos) {
+        text = "locality,category,month";
+    }
+
+    vector<int> dimensions;
+    stringstream list(text);
+    string item;
+    while (getline(list, item, ',')) {
+        item.erase(0, item.find_first_not_of(" \t"));
+        item.erase(item.find_last_not_of(" \t") + 1);
+        item = toLowerCopy(item);
+
+        int dimension = -1;
+        for (int d = 0; d < GROUP_DIMENSION_COUNT; ++d) {
+            if (item == GROUP_DIMENSION_NAMES[d]) {
+                dimension = d;
+            }
+        }
+        if (dimension < 0 || find(dimensions.begin(), dimensions.end(), dimension) != dimensions.end()) {
+            cout << "Invalid or repeated dimension: " << item << endl;
+            pressEnterToContinue();
+            return;
+        }
+        dimensions.push_back(dimension);
+    }
+
+    auto start = chrono::steady_clock::now();
+    GroupTable groups = rollupCustomers(dimensions);
+    double elapsedMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    vector<uint64_t> keys;
+    keys.reserve(groups.size());
+    for (const auto &group : groups) {
+        keys.push_back(group.first);
+    }
+    sort(keys.begin(), keys.end(),
+         [&](uint64_t a, uint64_t b) { return groupRowBefore(a, b, dimensions); });
+
+    int lineWidth = 0;
+    cout << endl << left;
+    for (int dimension : dimensions) {
+        cout << setw(GROUP_DIMENSION_WIDTHS[dimension]) << GROUP_DIMENSION_NAMES[dimension];
+        lineWidth += GROUP_DIMENSION_WIDTHS[dimension];
+    }
+    cout << right << setw(10) << "Count"
+         << setw(14) << "Units Sum" << setw(10) << "Avg" << setw(10) << "Min" << setw(10) << "Max"
+         << setw(16) << "Amount Sum" << setw(12) << "Avg" << setw(12) << "Min" << setw(12) << "Max" << endl;
+    lineWidth += 106;
+    cout << string(lineWidth, '-') << endl;
+
+    cout << fixed << setprecision(2);
+    for (uint64_t key : keys) {
+        const GroupAggregate &group = groups[key];
+        cout << left;
+        for (int dimension : dimensions) {
+            string label = groupLabel(key, dimension);
+            int width = GROUP_DIMENSION_WIDTHS[dimension];
+            if (static_cast<int>(label.length()) > width - 2) {
+                label = label.substr(0, width - 5) + "...";
+            }
+            cout << setw(width) << label;
+        }
+        cout << right << setw(10) << group.count
+             << setw(14) << group.unitsSum << setw(10) << group.unitsSum / group.count
+             << setw(10) << group.unitsMin << setw(10) << group.unitsMax
+             << setw(16) << group.amountSum << setw(12) << group.amountSum / group.count
+             << setw(12) << group.amountMin << setw(12) << group.amountMax << endl;
+    }
+    cout << left << string(lineWidth, '-') << endl;
+    cout << keys.size() << " row(s), aggregated in " << elapsedMs << " ms\n";
+
+    pressEnterToContinue();
+}
+
+// ================= Top-K and Percentile Reports =================
+// Top-K lists come from bounded heaps filled per partition and merged, so
+// no full sort is needed. Consumption percentiles come from a KLL quantile
+// sketch: it is built from the book at startup (partition sketches merged)
+// and then fed every bill issued. A sketch cannot drop a value, so values
+// that stop describing the book (re-bills, corrected readings, deletions)
+// are only counted, and the sketch is rebuilt before a report once they
+// could shift the percentiles by more than its own error.
+
+const size_t SKETCH_ACCURACY = 200; // KLL k; rank error is roughly 1.65 / k
+
+struct QuantileSketch {
+    size_t k;
+    size_t count;
+    double minValue, maxValue;
+    vector<vector<double>> levels; // items at level h stand for 2^h inputs
+    uint64_t randomState;
+
+    QuantileSketch() : k(SKETCH_ACCURACY), count(0),
+                       minValue(numeric_limits<double>::max()), maxValue(numeric_limits<double>::lowest()),
+                       levels(1), randomState(0x9E3779B97F4A7C15ULL) {}
+
+    size_t levelCapacity(size_t level) const {
+        size_t depth = levels.size() - 1 - level;
+        return max<size_t>(2, static_cast<size_t>(ceil(k * pow(2.0 / 3.0, depth))));
+    }
+
+    size_t retained() const {
+        size_t total = 0;
+        for (const auto &level : levels) total += level.size();
+        return total;
+    }
+
+    size_t totalCapacity() const {
+        size_t total = 0;
+        for (size_t h = 0; h < levels.size(); ++h) total += levelCapacity(h);
+        return total;
+    }
+
+    bool randomBit() {
+        randomState ^= randomState << 13;
+        randomState ^= randomState >> 7;
+        randomState ^= randomState << 17;
+        return randomState & 1;
+    }
+
+    // Halves the lowest full level, promoting every other item one level up
+    void compressOnce() {
+        for (size_t h = 0; h < levels.size(); ++h) {
+            if (levels[h].size() < levelCapacity(h)) {
+                continue;
+            }
+            if (h + 1 == levels.size()) {
+                levels.emplace_back();
+            }
+            vector<double> &level = levels[h];
+            sort(level.begin(), level.end());
+
+            // An odd item out stays at this level
+            bool keepLast = level.size() % 2 == 1;
+            double last = level.back();
+            if (keepLast) {
+                level.pop_back();
+            }
+            for (size_t i = randomBit() ? 1 : 0; i < level.size(); i += 2) {
+                levels[h + 1].push_back(level[i]);
+            }
+            level.clear();
+            if (keepLast) {
+                level.push_back(last);
+            }
+            return;
+        }
+    }
+
+    void add(double value) {
+        count++;
+        minValue = min(minValue, value);
+        maxValue = max(maxValue, value);
+        levels[0].push_back(value);
+        if (retained() >= totalCapacity()) {
+            compressOnce();
+        }
+    }
+
+    void merge(const QuantileSketch &other) {
+        if (other.levels.size() > levels.size()) {
+            levels.resize(other.levels.size());
+        }
+        for (size_t h = 0; h < other.levels.size(); ++h) {
+            levels[h].insert(levels[h].end(), other.levels[h].begin(), other.levels[h].end());
+        }
+        count += other.count;
+        minValue = min(minValue, other.minValue);
+        maxValue = max(maxValue, other.maxValue);
+        while (retained() >= totalCapacity()) {
+            compressOnce();
+        }
+    }
+
+    double quantile(double q) const {
+        vector<pair<double, uint64_t>> weighted;
+        uint64_t totalWeight = 0;
+        for (size_t h = 0; h < levels.size(); ++h) {
+            for (double value : levels[h]) {
+                weighted.push_back({value, 1ULL << h});
+                totalWeight += 1ULL << h;
+            }
+        }
+        if (weighted.empty()) {
+            return 0.0;
+        }
+        sort(weighted.begin(), weighted.end());
+
+        double target = q * totalWeight;
+        uint64_t cumulative = 0;
+        for (const auto &item : weighted) {
+            cumulative += item.second;
+            if (cumulative >= target) {
+                return item.first;
+            }
+        }
+        return weighted.back().first;
+    }
+};
+
+QuantileSketch consumptionSketch;
+size_t consumptionSuperseded = 0; // values in the sketch no longer in the book
+
+void recordConsumption(double units) {
+    consumptionSketch.add(units);
+}
+
+// Called when a customer's current consumption is replaced or removed
+void forgetConsumption() {
+    consumptionSuperseded++;
+}
+
+// Rebuilds the sketch once superseded values exceed about 1 / k of it,
+// about the sketch's own rank error
+void refreshConsumptionSketch() {
+    if (consumptionSuperseded * SKETCH_ACCURACY > consumptionSketch.count) {
+        rebuildConsumptionSketch();
+    }
+}
+
+void rebuildConsumptionSketch() {
+    size_t workers = partitionCount(customers.size());
+    vector<QuantileSketch> partials(workers);
+    runPartitioned(customers.size(), workers, [&](size_t p, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            partials[p].add(customers[i].unitsConsumed);
+        }
+    });
+
+    consumptionSketch = QuantileSketch();
+    for (const auto &partial : partials) {
+        consumptionSketch.merge(partial);
+    }
+    consumptionSuperseded = 0;
+}
+
+// Indices of the k customers with the largest value(), highest first.
+// Customers for which value() returns NaN are skipped.
+template <typename Value>
+vector<size_t> topCustomers(size_t k, Value value) {
+    typedef pair<double, size_t> Entry;
+    // Larger value first, lower index on ties. Used as the heap order this
+    // keeps the lowest-ranked entry on top, where it is replaced first.
+    auto ranksHigher = [](const Entry &a, const Entry &b) {
+        return a.first != b.first ? a.first > b.first : a.second < b.second;
+    };
+
+    size_t workers = partitionCount(customers.size());
+    vector<vector<Entry>> heaps(workers);
+    runPartitioned(customers.size(), workers, [&](size_t p, size_t begin, size_t end) {
+        vector<Entry> &heap = heaps[p];
+        for (size_t i = begin; i < end; ++i) {
+            double v = value(customers[i]);
+            if (v != v) {
+                continue;
+            }
+            Entry entry(v, i);
+            if (heap.size() < k) {
+                heap.push_back(entry);
+                push_heap(heap.begin(), heap.end(), ranksHigher);
+            } else if (ranksHigher(entry, heap.front())) {
+                pop_heap(heap.begin(), heap.end(), ranksHigher);
+                heap.back() = entry;
+                push_heap(heap.begin(), heap.end(), ranksHigher);
+            }
+        }
+    });
+
+    vector<Entry> best;
+    for (const auto &heap : heaps) {
+        best.insert(best.end(), heap.begin(), heap.end());
+    }
+    sort(best.begin(), best.end(), ranksHigher);
+    if (best.size() > k) {
+        best.resize(k);
+    }
+
+    vector<size_t> rows;
+    for (const auto &entry : best) {
+        rows.push_back(entry.second);
+    }
+    return rows;
+}
+
+void topConsumersReport() {
+    clearScreen();
+    cout << "=== TOP CONSUMERS & PERCENTILES ===\n\n";
+
+    if (customers.empty()) {
+        cout << "No customers found!\n";
+        pressEnterToContinue();
+        return;
+    }
+
+    cout << "1. Top-K by Units Consumed\n";
+    cout << "2. Top-K by Outstanding Bill Amount\n";
+    cout << "3. Consumption Percentiles\n";
+    int choice = getValidInt("Enter choice: ");
+
+    if (choice == 1 || choice == 2) {
+        int k = getValidInt("How many customers (K): ");
+        if (k <= 0) {
+            cout << "K must be at least 1.\n";
+            pressEnterToContinue();
+            return;
+        }
+
+        auto start = chrono::steady_clock::now();
+        vector<size_t> rows;
+        if (choice == 1) {
+            rows = topCustomers(k, [](const Customer &c) { return c.unitsConsumed; });
+        } else {
+            rows = topCustomers(k, [](const Customer &c) {
+                return c.isPaid ? numeric_limits<double>::quiet_NaN() : c.billAmount;
+            });
+        }
+        double elapsedMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        cout << endl << left << setw(6) << "Rank"
+             << setw(10) << "ID"
+             << setw(20) << "Name"
+             << setw(15) << "Locality"
+             << setw(12) << "Units Used"
+             << setw(12) << "Bill Amount"
+             << setw(10) << "Status" << endl;
+        cout << string(85, '-') << endl;
+
+        cout << fixed << setprecision(2);
+        for (size_t rank = 0; rank < rows.size(); ++rank) {
+            const Customer &customer = customers[rows[rank]];
+            string name = customerName(customer);
+            string locality = localityNames[customer.localityID];
+            cout << left << setw(6) << rank + 1
+                 << setw(10) << customer.customerID
+                 << setw(20) << (name.length() > 18 ? name.substr(0, 15) + "..." : name)
+                 << setw(15) << (locality.length() > 13 ? locality.substr(0, 10) + "..." : locality)
+                 << setw(12) << customer.unitsConsumed
+                 << setw(12) << customer.billAmount
+                 << setw(10) << (customer.isPaid ? "PAID" : "PENDING") << endl;
+        }
+        cout << string(85, '-') << endl;
+        cout << rows.size() << " customer(s) in " << elapsedMs << " ms\n";
+    } else if (choice == 3) {
+        refreshConsumptionSketch();
+        const QuantileSketch &sketch = consumptionSketch;
+        cout << fixed << setprecision(2);
+        cout << "\nConsumption Distribution (units per bill):\n";
+        cout << "------------------------------------------\n";
+        cout << "Bills Sampled: " << sketch.count - consumptionSuperseded << endl;
+        if (sketch.count > 0) {
+            cout << "Minimum: " << sketch.minValue << endl;
+            cout << "p50 (median): " << sketch.quantile(0.50) << endl;
+            cout << "p90: " << sketch.quantile(0.90) << endl;
+            cout << "p99: " << sketch.quantile(0.99) << endl;
+            cout << "Maximum: " << sketch.maxValue << endl;
+        }
+        cout << "------------------------------------------\n";
+        cout << "Covers each customer's current bill.\n";
+        cout << "Estimated from a " << sketch.retained() << "-item KLL sketch.\n";
+    } else {
+        cout << "Invalid choice!\n";
+    }
+
+    pressEnterToContinue();
+}
+
+// ================= Dunning Scheduler =================
+// Overdue bills move through the stages below. Each unpaid bill has at most
+// one pending timer in a hierarchical timer wheel keyed by day, so moving
+// the clock forward only touches bills whose next threshold was crossed.
+// Timers are cancelled lazily: a timer whose bill was paid, re-issued or
+// deleted is simply dropped when it fires.
+
+struct DunningStage {
+    int daysAfterDue;
+    double feeRate; // fraction of the original bill charged as a late fee
+    const char *notice;
+};
+
+const DunningStage DUNNING_STAGES[] = {
+    {1, 0.02, "First reminder: bill overdue"},
+    {15, 0.02, "Second reminder: payment still outstanding"},
+    {30, 0.0, "Final notice: supply may be disconnected"}
+};
+const int DUNNING_STAGE_COUNT = sizeof(DUNNING_STAGES) / sizeof(DUNNING_STAGES[0]);
+
+const int WHEEL_LEVELS = 3;
+const int WHEEL_SLOT_BITS = 6;
+const int WHEEL_SLOTS = 1 << WHEEL_SLOT_BITS;
+
+struct DunningTimer {
+    int customerID;
+    int day;        // day the timer fires
+    int level;      // dunning level the bill reaches when it fires
+    string dueDate; // identifies the bill the timer was set for
+};
+
+struct DunningEvent {
+    int day;
+    int customerID;
+    string name;
+    int level;
+    double fee;
+};
+
+// Level L holds timers 64^L to 64^(L+1) days away; a level's slot is
+// cascaded into the levels below when the clock reaches its start.
+struct TimerWheel {
+    int now;
+    vector<DunningTimer> slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    vector<DunningTimer> expired;  // due on or before `now`
+    vector<DunningTimer> overflow; // beyond the top level's horizon
+
+    TimerWheel() : now(0) {}
+};
+
+TimerWheel dunningWheel;
+
+void wheelInsert(TimerWheel &wheel, const DunningTimer &timer) {
+    int delta = timer.day - wheel.now;
+    if (delta <= 0) {
+        wheel.expired.push_back(timer);
+        return;
+    }
+    for (int level = 0; level < WHEEL_LEVELS; ++level) {
+        if (delta < (1 << (WHEEL_SLOT_BITS * (level + 1)))) {
+            int slot = (timer.day >> (WHEEL_SLOT_BITS * level)) & (WHEEL_SLOTS - 1);
+            wheel.slots[level][slot].push_back(timer);
+            return;
+        }
+    }
+    wheel.overflow.push_back(timer);
+}
+
+// Advances the wheel by one day and moves the timers due today into `due`
+void wheelTick(TimerWheel &wheel, vector<DunningTimer> &due) {
+    wheel.now++;
+
+    for (int level = 1; level <= WHEEL_LEVELS; ++level) {
+        if (wheel.now & ((1 << (WHEEL_SLOT_BITS * level)) - 1)) {
+            break;
+        }
+        vector<DunningTimer> moved;
+        if (level == WHEEL_LEVELS) {
+            moved.swap(wheel.overflow);
+        } else {
+            moved.swap(wheel.slots[level][(wheel.now >> (WHEEL_SLOT_BITS * level)) & (WHEEL_SLOTS - 1)]);
+        }
+        for (const auto &timer : moved) {
+            wheelInsert(wheel, timer);
+        }
+    }
+
+    vector<DunningTimer> &slot = wheel.slots[0][wheel.now & (WHEEL_SLOTS - 1)];
+    due.insert(due.end(), slot.begin(), slot.end());
+    slot.clear();
+    due.insert(due.end(), wheel.expired.begin(), wheel.expired.end());
+    wheel.expired.clear();
+}
+
+void scheduleNextDunning(const Customer &customer) {
+    if (customer.isPaid || customer.dunningLevel >= DUNNING_STAGE_COUNT) {
+        return;
+    }
+    int dueDay = daysFromDate(customer.dueDate);
+    if (dueDay < 0) {
+        return;
+    }
+    const DunningStage &stage = DUNNING_STAGES[customer.dunningLevel];
+    wheelInsert(dunningWheel, {customer.customerID, dueDay + stage.daysAfterDue,
+                               customer.dunningLevel + 1, customer.dueDate});
+}
+
+// Applies the stages for the given timers; stages that become due as a
+// result (after a long gap) are applied in the same pass.
+void fireDunningTimers(vector<DunningTimer> &due, vector<DunningEvent> &events) {
+    while (!due.empty()) {
+        vector<DunningTimer> batch;
+        batch.swap(due);
+        for (const auto &timer : batch) {
+            size_t index = findCustomer(timer.customerID);
+            if (index == CUSTOMER_NOT_FOUND) {
+                continue;
+            }
+            Customer &customer = customers[index];
+            if (customer.isPaid || customer.dueDate != timer.dueDate ||
+                customer.dunningLevel != timer.level - 1) {
+                continue;
+            }
+
+            const DunningStage &stage = DUNNING_STAGES[timer.level - 1];
+            double principal = customer.billAmount - customer.lateFee;
+            double fee = principal * stage.feeRate;
+            customer.lateFee += fee;
+            customer.billAmount += fee;
+            customer.dunningLevel = timer.level;
+            if (!commitCustomer(index)) {
+                // Another operator touched the bill first; follow their state
+                scheduleNextDunning(customer);
+                continue;
+            }
+
+            events.push_back({dunningWheel.now, customer.customerID, customerName(customer), timer.level, fee});
+            scheduleNextDunning(customer);
+        }
+
+        due.swap(dunningWheel.expired);
+    }
+}
+
+vector<DunningEvent> advanceDunningClock(int targetDay) {
+    vector<DunningEvent> events;
+
+    vector<DunningTimer> due;
+    due.swap(dunningWheel.expired);
+    fireDunningTimers(due, events);
+
+    while (dunningWheel.now < targetDay) {
+        wheelTick(dunningWheel, due);
+        fireDunningTimers(due, events);
+    }
+    dunningClock = dunningWheel.now;
+
+    if (!events.empty() && !replayMode) {
+        ofstream log(DUNNING_LOG_FILE, ios::app);
+        log << fixed << setprecision(2);
+        for (const auto &event : events) {
+            log << dateFromDays(event.day) << " | ID " << event.customerID << " | " << event.name
+                << " | Level " << event.level << " | Late fee Rs. " << event.fee
+                << " | " << DUNNING_STAGES[event.level - 1].notice << "\n";
+        }
+    }
+    return events;
+}
+
+void rebuildDunningWheel() {
+    dunningWheel = TimerWheel();
+    dunningWheel.now = dunningClock;
+    for (const auto &customer : customers) {
+        scheduleNextDunning(customer);
+    }
+}
+
+// Rebuilds the wheel from the stored dunning state and catches up to today
+void startDunningScheduler(int today) {
+    if (dunningClock < 0) {
+        dunningClock = today;
+    }
+    rebuildDunningWheel();
+
+    if (today < dunningClock) {
+        cout << "Dunning clock is at " << dateFromDays(dunningClock)
+             << "; it cannot move back to " << dateFromDays(today) << ".\n";
+    }
+    vector<DunningEvent> events = advanceDunningClock(today);
+    if (!events.empty()) {
+        cout << events.size() << " dunning event(s) raised";
+        cout << (replayMode ? string(".\n") : "; see " + DUNNING_LOG_FILE + ".\n");
+    }
+}
+
+void runDunning() {
+    clearScreen();
+    cout << "=== RUN DUNNING ===\n\n";
+    cout << "Dunning clock: " << dateFromDays(dunningClock) << endl;
+
+    string date;
+    cout << "Advance clock to date (YYYY-MM-DD, blank for today): ";
+    getline(cin, date);
+
+    int target = date.empty() ? daysFromDate(getCurrentDate()) : daysFromDate(date);
+    if (target < 0) {
+        cout << "Invalid date: " << date << endl;
+        pressEnterToContinue();
+        return;
+    }
+    if (target < dunningClock) {
+        cout << "The dunning clock cannot move backwards.\n";
+        pressEnterToContinue();
+        return;
+    }
+
+    vector<DunningEvent> events = advanceDunningClock(target);
+
+    if (events.empty()) {
+        cout << "\nNo bills crossed a dunning threshold.\n";
+    } else {
+        cout << endl << left << setw(12) << "Date"
+             << setw(10) << "ID"
+             << setw(20) << "Name"
+             << setw(7) << "Level"
+             << setw(12) << "Late Fee"
+             << "Notice" << endl;
+        cout << string(100, '-') << endl;
+
+        cout << fixed << setprecision(2);
+        double totalFees = 0.0;
+        for (const auto &event : events) {
+            totalFees += event.fee;
+            cout << left << setw(12) << dateFromDays(event.day)
+                 << setw(10) << event.customerID
+                 << setw(20) << (event.name.length() > 18 ? event.name.substr(0, 15) + "..." : event.name)
+                 << setw(7) << event.level
+                 << setw(12) << event.fee
+                 << DUNNING_STAGES[event.level - 1].notice << endl;
+        }
+        cout << string(100, '-') << endl;
+        cout << events.size() << " event(s), total late fees Rs. " << totalFees << endl;
+    }
+    cout << "Dunning clock now at " << dateFromDays(dunningClock) << endl;
+
+    pressEnterToContinue();
+}
+
+// ================= Shared Store (multi-operator mode) =================
+// With --shared, the customer book lives in customers.shm, a memory-mapped
+// file that every console on the host maps. A process-shared reader-writer
+// lock in the header guards it, and every record carries a version stamp.
+// Each process keeps working on its local `customers` copy: it pulls
+// changed records before every menu action and writes its own changes
+// through immediately. A write is refused when the record's version moved
+// since it was read, so one operator can never silently overwrite another.
+// Text fields are stored in fixed-size slots. Longer values are refused at
+// input, and a store is never built from a file that holds any.
+//
+// The header remembers which customers.dat the store was last loaded from or
+// saved to. If the file has changed since (a save in normal mode), the store
+// is stale: it is reloaded from the file when nobody else is attached, and
+// shared mode refuses to start while others still are. Every attached
+// process holds a shared flock on customers.shm to make that check possible.
+
+const uint64_t SHARED_STORE_MAGIC = 0x314D485353424545ULL; // "EEBSSHM1"
+const uint32_t SHARED_STORE_LAYOUT = 3;
+const uint32_t SHARED_MIN_CAPACITY = 65536;
+
+struct SharedRecord {
+    uint64_t version;  // generation of the last write to this slot
+    int32_t customerID;
+    int32_t dunningLevel;
+    uint8_t deleted;
+    uint8_t isPaid;
+    uint8_t category;
+    double previousReading;
+    double currentReading;
+    double unitsConsumed;
+    double billAmount;
+    double lateFee;
+    char name[64];
+    char address[128];
+    char contact[32];
+    char billingDate[12];
+    char dueDate[12];
+};
+
+// Identifies one version of customers.dat; saves replace the file, so the
+// inode changes along with the size and modification time
+struct DataFileStamp {
+    uint64_t inode;
+    uint64_t size;
+    int64_t modifiedSec;
+    int64_t modifiedNsec;
+};
+
+struct SharedHeader {
+    uint64_t magic;
+    uint32_t layout;
+    uint32_t capacity;       // record slots backed by the file
+    uint32_t count;          // slots handed out, deleted ones included
+    int32_t nextCustomerID;
+    uint64_t generation;     // bumped on every committed write
+    Tariff tariff;
+    DataFileStamp dataFile;  // customers.dat as last loaded or saved
+    pthread_rwlock_t lock;
+};
+
+struct SharedStore {
+    bool active;
+    int fd;
+    SharedHeader *header;
+    SharedRecord *records;
+    size_t mappedCapacity;
+    uint64_t seenGeneration;
+    bool rebuild;                         // local copy must be rebuilt on next sync
+    bool reindex;                         // local positions shifted; redo localIndex on next sync
+    vector<uint64_t> seenVersions;        // per slot, version last copied locally
+    vector<long> localIndex;              // per slot, index into customers or -1
+    unordered_map<int, uint32_t> slotByID;
+
+    SharedStore() : active(false), fd(-1), header(nullptr), records(nullptr),
+                    mappedCapacity(0), seenGeneration(0), rebuild(false), reindex(false) {}
+};
+
+SharedStore sharedStore;
+
+// Longest text the store holds for update-menu field 1-3
+size_t sharedTextLimit(int field) {
+    switch (field) {
+        case 1: return sizeof(SharedRecord::name) - 1;
+        case 2: return sizeof(SharedRecord::address) - 1;
+        default: return sizeof(SharedRecord::contact) - 1;
+    }
+}
+
+#ifndef _WIN32
+
+size_t sharedRecordOffset() {
+    return (sizeof(SharedHeader) + 63) & ~static_cast<size_t>(63);
+}
+
+size_t sharedStoreBytes(size_t capacity) {
+    return sharedRecordOffset() + capacity * sizeof(SharedRecord);
+}
+
+template <size_t N>
+bool fitsSharedField(const char (&)[N], const string &value) {
+    return value.size() < N;
+}
+
+template <size_t N>
+void copyToSharedField(char (&field)[N], const string &value) {
+    memcpy(field, value.data(), value.size());
+    field[value.size()] = '\0';
+}
+
+// Leaves the record untouched and returns false if a text field is too long
+bool customerToShared(const Customer &customer, SharedRecord &record) {
+    ColdFields fields = coldFields(customer);
+    if (!fitsSharedField(record.name, fields.name) || !fitsSharedField(record.address, fields.address) ||
+        !fitsSharedField(record.contact, fields.contact) ||
+        !fitsSharedField(record.billingDate, customer.billingDate) ||
+        !fitsSharedField(record.dueDate, customer.dueDate)) {
+        return false;
+    }
+    record.customerID = customer.customerID;
+    record.dunningLevel = customer.dunningLevel;
+    record.deleted = 0;
+    record.isPaid = customer.isPaid ? 1 : 0;
+    record.category = customer.category;
+    record.previousReading = customer.previousReading;
+    record.currentReading = customer.currentReading;
+    record.unitsConsumed = customer.unitsConsumed;
+    record.billAmount = customer.billAmount;
+    record.lateFee = customer.lateFee;
+    copyToSharedField(record.name, fields.name);
+    copyToSharedField(record.address, fields.address);
+    copyToSharedField(record.contact, fields.contact);
+    copyToSharedField(record.billingDate, customer.billingDate);
+    copyToSharedField(record.dueDate, customer.dueDate);
+    return true;
+}
+
+Customer customerFromShared(const SharedRecord &record) {
+    Customer customer;
+    customer.customerID = record.customerID;
+    customer.dunningLevel = record.dunningLevel;
+    customer.isPaid = record.isPaid != 0;
+    customer.previousReading = record.previousReading;
+    customer.currentReading = record.currentReading;
+    customer.unitsConsumed = record.unitsConsumed;
+    customer.billAmount = record.billAmount;
+    customer.lateFee = record.lateFee;
+    customer.name = record.name;
+    customer.address = record.address;
+    customer.contact = record.contact;
+    customer.billingDate = record.billingDate;
+    customer.dueDate = record.dueDate;
+    customer.category = record.category < CATEGORY_COUNT ? record.category : static_cast<int>(CATEGORY_DOMESTIC);
+    customer.localityID = localityIDFor(customer.address);
+    return customer;
+}
+
+bool mapSharedStore(size_t capacity) {
+    void *mapping = mmap(nullptr, sharedStoreBytes(capacity), PROT_READ | PROT_WRITE,
+                         MAP_SHARED, sharedStore.fd, 0);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    // The old view is dropped only after the new one exists, so a lock held
+    // through the old mapping stays valid (both views share the same pages)
+    if (sharedStore.header) {
+        munmap(sharedStore.header, sharedStoreBytes(sharedStore.mappedCapacity));
+    }
+    sharedStore.header = static_cast<SharedHeader*>(mapping);
+    sharedStore.records = reinterpret_cast<SharedRecord*>(static_cast<char*>(mapping) + sharedRecordOffset());
+    sharedStore.mappedCapacity = capacity;
+    return true;
+}
+
+void lockSharedStore(bool exclusive) {
+    if (exclusive) {
+        pthread_rwlock_wrlock(&sharedStore.header->lock);
+    } else {
+        pthread_rwlock_rdlock(&sharedStore.header->lock);
+    }
+    // Another operator may have grown the file since we last looked
+    if (sharedStore.header->capacity != sharedStore.mappedCapacity) {
+        if (!mapSharedStore(sharedStore.header->capacity)) {
+            cout << "Error remapping " << SHARED_STORE_FILE << "!\n";
+            exit(1);
+        }
+    }
+}
+
+void unlockSharedStore() {
+    pthread_rwlock_unlock(&sharedStore.header->lock);
+}
+
+// Caller holds the write lock
+bool growSharedStore() {
+    uint32_t capacity = sharedStore.header->capacity * 2;
+    if (ftruncate(sharedStore.fd, sharedStoreBytes(capacity)) != 0 || !mapSharedStore(capacity)) {
+        return false;
+    }
+    sharedStore.header->capacity = capacity;
+    return true;
+}
+
+// All zero when the file does not exist
+DataFileStamp currentDataFileStamp() {
+    DataFileStamp stamp = {0, 0, 0, 0};
+    struct stat info;
+    if (stat(DATA_FILE.c_str(), &info) == 0) {
+        stamp.inode = info.st_ino;
+        stamp.size = info.st_size;
+        stamp.modifiedSec = info.st_mtime;
+#ifdef __APPLE__
+        stamp.modifiedNsec = info.st_mtimespec.tv_nsec;
+#else
+        stamp.modifiedNsec = info.st_mtim.tv_nsec;
+#endif
+    }
+    return stamp;
+}
+
+bool sameDataFile(const DataFileStamp &a, const DataFileStamp &b) {
+    return a.inode == b.inode && a.size == b.size &&
+           a.modifiedSec == b.modifiedSec && a.modifiedNsec == b.modifiedNsec;
+}
+
+// Caller holds the file lock exclusively, so nobody else has the store mapped
+bool initializeSharedStore() {
+    loadData();
+
+    // Checked before the store is touched, so a refusal leaves it as it was
+    ColdFieldReader reader;
+    for (const auto &customer : customers) {
+        if (reader.read(customer, COLD_NAME).size() > sharedTextLimit(1) ||
+            reader.read(customer, COLD_ADDRESS).size() > sharedTextLimit(2) ||
+            reader.read(customer, COLD_CONTACT).size() > sharedTextLimit(3)) {
+            cout << "Customer " << customer.customerID << " has a name, address or contact too long for "
+                 << "shared mode (at most " << sharedTextLimit(1) << ", " << sharedTextLimit(2) << " and "
+                 << sharedTextLimit(3) << " characters). Shorten it in normal mode first.\n";
+            return false;
+        }
+    }
+    if (size_t damaged = damagedColdBlocks()) {
+        cout << "The text of " << damaged << " block(s) in " << DATA_FILE << " is damaged, so it cannot be shared.\n";
+        return false;
+    }
+
+    if (sharedStore.header) {
+        sharedStore.header->magic = 0;
+    }
+    int nextID = 1001;
+    for (const auto &customer : customers) {
+        nextID = max(nextID, customer.customerID + 1);
+    }
+
+    uint32_t capacity = max<uint32_t>(SHARED_MIN_CAPACITY, customers.size() * 2);
+    if (ftruncate(sharedStore.fd, sharedStoreBytes(capacity)) != 0 || !mapSharedStore(capacity)) {
+        cout << "Error sizing " << SHARED_STORE_FILE << "!\n";
+        return false;
+    }
+
+    SharedHeader *header = sharedStore.header;
+    header->layout = SHARED_STORE_LAYOUT;
+    header->capacity = capacity;
+    header->count = customers.size();
+    header->nextCustomerID = nextID;
+    header->generation = 1;
+    header->tariff = currentTariff;
+    header->dataFile = currentDataFileStamp();
+    for (size_t i = 0; i < customers.size(); ++i) {
+        customerToShared(customers[i], sharedStore.records[i]);
+        sharedStore.records[i].version = header->generation;
+    }
+
+    pthread_rwlockattr_t attr;
+    int error = pthread_rwlockattr_init(&attr);
+    if (error == 0) {
+        error = pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        if (error == 0) {
+            error = pthread_rwlock_init(&header->lock, &attr);
+        }
+        pthread_rwlockattr_destroy(&attr);
+    }
+    if (error != 0) {
+        cout << "Error creating the shared store lock: " << strerror(error) << endl;
+        return false;
+    }
+
+    // Written last so a half-initialized file is never mistaken for a valid one
+    header->magic = SHARED_STORE_MAGIC;
+    msync(header, sharedStoreBytes(capacity), MS_SYNC);
+    return true;
+}
+
+bool openSharedStore() {
+    sharedStore.fd = open(SHARED_STORE_FILE.c_str(), O_RDWR | O_CREAT, 0666);
+    if (sharedStore.fd < 0) {
+        cout << "Error opening " << SHARED_STORE_FILE << "!\n";
+        return false;
+    }
+
+    // Attached processes hold the file lock shared for their whole session,
+    // so getting it exclusively means nobody else is attached. The rwlock
+    // guards the records once the store is set up.
+    bool alone = flock(sharedStore.fd, LOCK_EX | LOCK_NB) == 0;
+    if (!alone) {
+        flock(sharedStore.fd, LOCK_SH);
+    }
+
+    struct stat info;
+    bool ok = fstat(sharedStore.fd, &info) == 0;
+    bool stale = false;
+    if (ok && info.st_size == 0) {
+        if (alone && !initializeSharedStore()) {
+            return false;
+        }
+        ok = alone;
+        if (ok) {
+            cout << "Created " << SHARED_STORE_FILE << " from " << DATA_FILE << ".\n";
+        }
+    } else if (ok) {
+        ok = static_cast<size_t>(info.st_size) >= sharedStoreBytes(0) && mapSharedStore(0);
+        if (ok && (sharedStore.header->magic != SHARED_STORE_MAGIC ||
+                   sharedStore.header->layout != SHARED_STORE_LAYOUT)) {
+            ok = false;
+        }
+        if (ok) {
+            ok = mapSharedStore(sharedStore.header->capacity);
+        }
+        stale = ok && !sameDataFile(sharedStore.header->dataFile, currentDataFileStamp());
+        if (stale && alone) {
+            if (!initializeSharedStore()) {
+                return false;
+            }
+            stale = false;
+            cout << DATA_FILE << " changed since " << SHARED_STORE_FILE
+                 << " was last saved; reloaded it.\n";
+        }
+    }
+
+    if (alone) {
+        flock(sharedStore.fd, LOCK_SH);
+    }
+
+    if (stale) {
+        cout << "Error: " << DATA_FILE << " was changed outside shared mode while other operators\n"
+             << "are attached to " << SHARED_STORE_FILE << ". Start again once they have exited.\n";
+        return false;
+    }
+    if (!ok) {
+        cout << "Error: " << SHARED_STORE_FILE << " is not a valid shared store.\n";
+        return false;
+    }
+
+    sharedStore.active = true;
+    sharedStore.rebuild = true;
+    syncFromSharedStore();
+    cout << "Shared mode: " << customers.size() << " customer records in " << SHARED_STORE_FILE << ".\n";
+    return true;
+}
+
+// Caller holds the lock
+void rebuildFromSharedStore() {
+    uint32_t count = sharedStore.header->count;
+    customers.clear();
+    sharedStore.slotByID.clear();
+    sharedStore.seenVersions.assign(count, 0);
+    sharedStore.localIndex.assign(count, -1);
+
+    for (uint32_t slot = 0; slot < count; ++slot) {
+        const SharedRecord &record = sharedStore.records[slot];
+        sharedStore.seenVersions[slot] = record.version;
+        if (!record.deleted) {
+            sharedStore.localIndex[slot] = customers.size();
+            sharedStore.slotByID[record.customerID] = slot;
+            customers.push_back(customerFromShared(record));
+        }
+    }
+    sharedStore.rebuild = false;
+    sharedStore.reindex = false;
+    rebuildCustomerIndex();
+    rebuildDunningWheel();
+    rebuildConsumptionSketch();
+}
+
+// Points every slot at its customer's current position in `customers`
+void reindexSharedSlots() {
+    sharedStore.localIndex.assign(sharedStore.seenVersions.size(), -1);
+    for (size_t i = 0; i < customers.size(); ++i) {
+        auto found = sharedStore.slotByID.find(customers[i].customerID);
+        if (found != sharedStore.slotByID.end()) {
+            sharedStore.localIndex[found->second] = i;
+        }
+    }
+    sharedStore.reindex = false;
+}
+
+void syncFromSharedStore() {
+    if (!sharedStore.active) {
+        return;
+    }
+
+    lockSharedStore(false);
+    SharedHeader *header = sharedStore.header;
+    if (sharedStore.rebuild) {
+        rebuildFromSharedStore();
+    } else if (header->generation != sharedStore.seenGeneration) {
+        uint32_t count = header->count;
+        sharedStore.seenVersions.resize(count, 0);
+        sharedStore.localIndex.resize(count, -1);
+        if (sharedStore.reindex) {
+            reindexSharedSlots();
+        }
+
+        // Version stamps let us skip every record nobody touched. Records
+        // added elsewhere are appended; deletions are collected and removed
+        // in one pass.
+        vector<bool> removed;
+        for (uint32_t slot = 0; slot < count; ++slot) {
+            const SharedRecord &record = sharedStore.records[slot];
+            if (record.version == sharedStore.seenVersions[slot]) {
+                continue;
+            }
+            sharedStore.seenVersions[slot] = record.version;
+            long local = sharedStore.localIndex[slot];
+            if (record.deleted) {
+                if (local >= 0) {
+                    removed.resize(customers.size(), false);
+                    removed[local] = true;
+                    sharedStore.slotByID.erase(record.customerID);
+                    forgetConsumption();
+                }
+            } else if (local < 0) {
+                sharedStore.localIndex[slot] = customers.size();
+                sharedStore.slotByID[record.customerID] = slot;
+                customerIndex[record.customerID] = customers.size();
+                customers.push_back(customerFromShared(record));
+                scheduleNextDunning(customers.back());
+                recordConsumption(record.unitsConsumed);
+            } else {
+                Customer &customer = customers[local];
+                if (customer.unitsConsumed != record.unitsConsumed) {
+                    // Billed or corrected elsewhere
+                    forgetConsumption();
+                    recordConsumption(record.unitsConsumed);
+                }
+                customer = customerFromShared(record);
+                scheduleNextDunning(customer);
+            }
+        }
+
+        if (!removed.empty()) {
+            size_t kept = 0;
+            for (size_t i = 0; i < customers.size(); ++i) {
+                if (i < removed.size() && removed[i]) {
+                    continue;
+                }
+                if (kept != i) {
+                    customers[kept] = move(customers[i]);
+                }
+                ++kept;
+            }
+            customers.resize(kept);
+            rebuildCustomerIndex();
+            reindexSharedSlots();
+        }
+
+        currentTariff = header->tariff;
+        sharedStore.seenGeneration = header->generation;
+    }
+    unlockSharedStore();
+}
+
+bool commitCustomer(size_t index) {
+    if (!sharedStore.active) {
+        return true;
+    }
+
+    Customer &customer = customers[index];
+    bool ok = true;
+
+    lockSharedStore(true);
+    SharedHeader *header = sharedStore.header;
+    auto found = sharedStore.slotByID.find(customer.customerID);
+    if (found == sharedStore.slotByID.end()) {
+        if (header->count == header->capacity && !growSharedStore()) {
+            ok = false;
+            cout << "Error growing " << SHARED_STORE_FILE << "!\n";
+        } else if (!customerToShared(customer, sharedStore.records[header->count])) {
+            ok = false;
+            cout << "Text too long for " << SHARED_STORE_FILE << "!\n";
+        } else {
+            uint32_t slot = header->count;
+            SharedRecord &record = sharedStore.records[slot];
+            record.version = ++header->generation;
+            header->count = slot + 1;
+
+            sharedStore.slotByID[customer.customerID] = slot;
+            sharedStore.seenVersions.resize(slot + 1, 0);
+            sharedStore.localIndex.resize(slot + 1, -1);
+            sharedStore.seenVersions[slot] = record.version;
+            sharedStore.localIndex[slot] = index;
+        }
+    } else {
+        uint32_t slot = found->second;
+        SharedRecord &record = sharedStore.records[slot];
+        if (record.version != sharedStore.seenVersions[slot]) {
+            // Someone else wrote first: drop our change and show theirs
+            // (a deletion is picked up by the next sync)
+            ok = false;
+            if (!record.deleted) {
+                if (customer.unitsConsumed != record.unitsConsumed) {
+                    forgetConsumption();
+                    recordConsumption(record.unitsConsumed);
+                }
+                customer = customerFromShared(record);
+                scheduleNextDunning(customer);
+                sharedStore.seenVersions[slot] = record.version;
+            }
+        } else if (!customerToShared(customer, record)) {
+            ok = false;
+            cout << "Text too long for " << SHARED_STORE_FILE << "!\n";
+        } else {
+            record.version = ++header->generation;
+            sharedStore.seenVersions[slot] = record.version;
+        }
+    }
+    unlockSharedStore();
+    return ok;
+}
+
+bool commitCustomerDeletion(int id) {
+    if (!sharedStore.active) {
+        return true;
+    }
+
+    bool ok = false;
+    lockSharedStore(true);
+    auto found = sharedStore.slotByID.find(id);
+    if (found != sharedStore.slotByID.end()) {
+        uint32_t slot = found->second;
+        SharedRecord &record = sharedStore.records[slot];
+        if (record.version == sharedStore.seenVersions[slot]) {
+            record.deleted = 1;
+            record.version = ++sharedStore.header->generation;
+            sharedStore.seenVersions[slot] = record.version;
+            sharedStore.slotByID.erase(found);
+            ok = true;
+        }
+    }
+    // Local positions shift when the caller erases the record
+    if (ok) {
+        sharedStore.reindex = true;
+    }
+    unlockSharedStore();
+    return ok;
+}
+
+void commitTariff() {
+    if (!sharedStore.active) {
+        return;
+    }
+    lockSharedStore(true);
+    sharedStore.header->tariff = currentTariff;
+    ++sharedStore.header->generation;
+    unlockSharedStore();
+}
+
+// Called by saveData with the data file lock held, once the new file is in place
+void recordDataFileSaved() {
+    if (!sharedStore.active) {
+        return;
+    }
+    lockSharedStore(true);
+    sharedStore.header->dataFile = currentDataFileStamp();
+    unlockSharedStore();
+}
+
+int allocateSharedCustomerID() {
+    if (!sharedStore.active) {
+        return -1;
+    }
+    lockSharedStore(true);
+    int id = sharedStore.header->nextCustomerID++;
+    unlockSharedStore();
+    return id;
+}
+
+int lockDataFile() {
+    if (!sharedStore.active) {
+        return -1;
+    }
+    string lockPath = DATA_FILE + ".lock";
+    int fd = open(lockPath.c_str(), O_RDWR | O_CREAT, 0666);
+    if (fd >= 0) {
+        flock(fd, LOCK_EX);
+    }
+    return fd;
+}
+
+void unlockDataFile(int fd) {
+    if (fd >= 0) {
+        flock(fd, LOCK_UN);
+        close(fd);
+    }
+}
+
+#else
+
+bool openSharedStore() {
+    cout << "Shared mode is not supported on Windows.\n";
+    return false;
+}
+
+void syncFromSharedStore() {}
+bool commitCustomer(size_t) { return true; }
+bool commitCustomerDeletion(int) { return true; }
+void recordDataFileSaved() {}
+void commitTariff() {}
+int allocateSharedCustomerID() { return -1; }
+int lockDataFile() { return -1; }
+void unlockDataFile(int) {}
+
+#endif
+
+// ================= Background Export =================
+// Streams the customer book to exports/customers.csv and to a columnar file,
+// exports/customers.ebcol, without holding up the menu. When the export
+// starts, the numeric and date fields of the book are copied into compact
+// rows, so edits made meanwhile do not leak into it. Text still on disk is
+// not copied: the encoder reads it through coldRef, and saveData waits for
+// the export before it replaces the data file. An encoder thread cuts the
+// snapshot into row groups and turns each into CSV text and column chunks. A writer thread takes them from a bounded queue and
+// appends them to both files. Files are written under temporary names and
+// renamed when complete.
+//
+// Columnar layout (integers little-endian):
+//   "EBCOL1\0\0"
+//   row groups, each one chunk per column in schema order
+//   footer: column count, per column its name (u32 length + bytes) and
+//           type (u8: 0 int32, 1 double, 2 bool, 3 string); row group
+//           count, per group its row count (u32) and per chunk its offset
+//           and size (u64 each)
+//   footer size (u64), "EBCOL1\0\0"
+// Chunks are uncompressed so other tools can read them directly. int32 and
+// double values are stored back to back, bools one byte each. A string
+// chunk is rows + 1 u32 end offsets (the first is 0) followed by the bytes.
+
+enum ExportColumnType { EXPORT_INT32, EXPORT_DOUBLE, EXPORT_BOOL, EXPORT_STRING };
+
+struct ExportColumn {
+    const char *name;
+    ExportColumnType type;
+};
+
+// encodeExportRow() must fill the columns in this order
+const ExportColumn EXPORT_COLUMNS[] = {
+    {"id", EXPORT_INT32},
+    {"name", EXPORT_STRING},
+    {"address", EXPORT_STRING},
+    {"contact", EXPORT_STRING},
+    {"locality", EXPORT_STRING},
+    {"category", EXPORT_STRING},
+    {"previous_reading", EXPORT_DOUBLE},
+    {"current_reading", EXPORT_DOUBLE},
+    {"units", EXPORT_DOUBLE},
+    {"amount", EXPORT_DOUBLE},
+    {"late_fee", EXPORT_DOUBLE},
+    {"billing_date", EXPORT_STRING},
+    {"due_date", EXPORT_STRING},
+    {"paid", EXPORT_BOOL},
+    {"dunning_level", EXPORT_INT32}
+};
+
+const size_t EXPORT_COLUMN_COUNT = sizeof(EXPORT_COLUMNS) / sizeof(EXPORT_COLUMNS[0]);
+const size_t EXPORT_ROW_GROUP_ROWS = 65536;
+const size_t EXPORT_QUEUE_DEPTH = 4; // row groups encoded ahead of the writer
+const char EXPORT_MAGIC[8] = {'E', 'B', 'C', 'O', 'L', '1', '\0', '\0'};
+const string EXPORT_DIR = "exports";
+
+const uint32_t EXPORT_NO_TEXT = numeric_limits<uint32_t>::max();
+
+// One customer as the snapshot holds it
+struct ExportRow {
+    int32_t customerID;
+    int32_t category;
+    uint32_t localityID;
+    int32_t dunningLevel;
+    int64_t coldRef;
+    double previousReading;
+    double currentReading;
+    double unitsConsumed;
+    double billAmount;
+    double lateFee;
+    uint32_t text;        // index into ExportSnapshot::texts, or EXPORT_NO_TEXT
+    bool isPaid;
+    bool longDates;       // dates did not fit below and are kept in texts
+    char billingDate[12]; // NUL-terminated
+    char dueDate[12];
+};
+
+// Text that exists only in memory: the fields of resident customers, and
+// dates too long for ExportRow
+struct ExportText {
+    ColdFields fields;
+    string billingDate;
+    string dueDate;
+};
+
+struct ExportSnapshot {
+    vector<ExportRow> rows;
+    vector<ExportText> texts;
+    vector<string> localities;
+};
+
+struct ExportRowGroup {
+    size_t rows;
+    string csv;
+    vector<string> chunks; // one per column
+};
+
+// Builds one row group a cell at a time, in CSV and in column form
+struct ExportEncoder {
+    vector<string> values;          // fixed-width columns
+    vector<vector<uint32_t>> ends;  // string columns: end offset of each value
+    string csv;
+    size_t column;
+
+    ExportEncoder() : values(EXPORT_COLUMN_COUNT), ends(EXPORT_COLUMN_COUNT), column(0) {}
+
+    void beginCell() {
+        if (column > 0) {
+            csv += ',';
+        }
+    }
+
+    template <typename T>
+    void addFixed(T value) {
+        values[column].append(reinterpret_cast<const char*>(&value), sizeof(value));
+        column++;
+    }
+
+    void addInt(int32_t value) {
+        beginCell();
+        csv += to_string(value);
+        addFixed(value);
+    }
+
+    void addDouble(double value) {
+        beginCell();
+        csv += formatNumber(value);
+        addFixed(value);
+    }
+
+    void addBool(bool value) {
+        beginCell();
+        csv += value ? "true" : "false";
+        addFixed<uint8_t>(value ? 1 : 0);
+    }
+
+    // RFC 4180: quote fields holding a comma, quote or line break
+    void addString(const string &value) {
+        beginCell();
+        if (value.find_first_of(",\"\r\n") == string::npos) {
+            csv += value;
+        } else {
+            csv += '"';
+            for (char c : value) {
+                csv += c;
+                if (c == '"') {
+                    csv += '"';
+                }
+            }
+            csv += '"';
+        }
+        values[column] += value;
+        ends[column].push_back(values[column].size());
+        column++;
+    }
+
+    void endRow() {
+        csv += "\r\n";
+        column = 0;
+    }
+
+    ExportRowGroup finish(size_t rows) {
+        ExportRowGroup group;
+        group.rows = rows;
+        group.csv.swap(csv);
+        group.chunks.resize(EXPORT_COLUMN_COUNT);
+        for (size_t c = 0; c < EXPORT_COLUMN_COUNT; ++c) {
+            string &chunk = group.chunks[c];
+            if (EXPORT_COLUMNS[c].type == EXPORT_STRING) {
+                uint32_t start = 0;
+                chunk.append(reinterpret_cast<const char*>(&start), sizeof(start));
+                chunk.append(reinterpret_cast<const char*>(ends[c].data()), ends[c].size() * sizeof(uint32_t));
+            }
+            chunk += values[c];
+            string().swap(values[c]);
+            ends[c].clear();
+        }
+        return group;
+    }
+};
+
+template <size_t N>
+void copyExportDate(char (&field)[N], const string &date) {
+    memcpy(field, date.c_str(), date.size() + 1);
+}
+
+// Runs on the menu thread, so it copies as little as it can, split over
+// the same partitions as queries
+void takeExportSnapshot(ExportSnapshot &snapshot) {
+    snapshot.rows.resize(customers.size());
+    snapshot.localities = localityNames;
+
+    size_t workers = partitionCount(customers.size());
+    vector<vector<ExportText>> texts(workers);
+    vector<vector<size_t>> textRows(workers);
+    runPartitioned(customers.size(), workers, [&](size_t p, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const Customer &customer = customers[i];
+            ExportRow &row = snapshot.rows[i];
+            row.customerID = customer.customerID;
+            row.category = customer.category;
+            row.localityID = customer.localityID;
+            row.dunningLevel = customer.dunningLevel;
+            row.coldRef = customer.coldRef;
+            row.previousReading = customer.previousReading;
+            row.currentReading = customer.currentReading;
+            row.unitsConsumed = customer.unitsConsumed;
+            row.billAmount = customer.billAmount;
+            row.lateFee = customer.lateFee;
+            row.isPaid = customer.isPaid;
+            row.text = EXPORT_NO_TEXT;
+
+            row.longDates = customer.billingDate.size() >= sizeof(row.billingDate) ||
+                            customer.dueDate.size() >= sizeof(row.dueDate);
+            if (!row.longDates) {
+                copyExportDate(row.billingDate, customer.billingDate);
+                copyExportDate(row.dueDate, customer.dueDate);
+            }
+            if (customer.coldRef < 0 || row.longDates) {
+                row.text = texts[p].size();
+                textRows[p].push_back(i);
+                texts[p].emplace_back();
+                ExportText &text = texts[p].back();
+                if (customer.coldRef < 0) {
+                    text.fields = {customer.name, customer.address, customer.contact};
+                }
+                if (row.longDates) {
+                    text.billingDate = customer.billingDate;
+                    text.dueDate = customer.dueDate;
+                }
+            }
+        }
+    });
+
+    // Texts were numbered per partition; renumber them into one list
+    for (size_t p = 0; p < workers; ++p) {
+        size_t base = snapshot.texts.size();
+        for (size_t row : textRows[p]) {
+            snapshot.rows[row].text += base;
+        }
+        move(texts[p].begin(), texts[p].end(), back_inserter(snapshot.texts));
+    }
+}
+
+void encodeExportRow(ExportEncoder &encoder, const ExportRow &row, const ExportSnapshot &snapshot,
+                     ColdFieldReader &reader) {
+    const ExportText *text = row.text == EXPORT_NO_TEXT ? nullptr : &snapshot.texts[row.text];
+    encoder.addInt(row.customerID);
+    if (row.coldRef >= 0) {
+        encoder.addString(reader.read(row.coldRef, row.localityID, COLD_NAME));
+        encoder.addString(reader.read(row.coldRef, row.localityID, COLD_ADDRESS));
+        encoder.addString(reader.read(row.coldRef, row.localityID, COLD_CONTACT));
+    } else {
+        encoder.addString(text->fields.name);
+        encoder.addString(text->fields.address);
+        encoder.addString(text->fields.contact);
+    }
+    encoder.addString(row.localityID < snapshot.localities.size() ? snapshot.localities[row.localityID] : string());
+    encoder.addString(CATEGORY_NAMES[row.category]);
+    encoder.addDouble(row.previousReading);
+    encoder.addDouble(row.currentReading);
+    encoder.addDouble(row.unitsConsumed);
+    encoder.addDouble(row.billAmount);
+    encoder.addDouble(row.lateFee);
+    if (row.longDates) {
+        encoder.addString(text->billingDate);
+        encoder.addString(text->dueDate);
+    } else {
+        encoder.addString(row.billingDate);
+        encoder.addString(row.dueDate);
+    }
+    encoder.addBool(row.isPaid);
+    encoder.addInt(row.dunningLevel);
+    encoder.endRow();
+}
+
+// Bounded hand-off between the encoder and the writer
+struct ExportQueue {
+    mutex lock;
+    condition_variable changed;
+    deque<ExportRowGroup> groups;
+    bool finished;
+
+    ExportQueue() : finished(false) {}
+
+    void push(ExportRowGroup group) {
+        unique_lock<mutex> guard(lock);
+        changed.wait(guard, [this] { return groups.size() < EXPORT_QUEUE_DEPTH; });
+        groups.push_back(move(group));
+        changed.notify_all();
+    }
+
+    void close() {
+        lock_guard<mutex> guard(lock);
+        finished = true;
+        changed.notify_all();
+    }
+
+    // False once the queue is closed and drained
+    bool pop(ExportRowGroup &group) {
+        unique_lock<mutex> guard(lock);
+        changed.wait(guard, [this] { return !groups.empty() || finished; });
+        if (groups.empty()) {
+            return false;
+        }
+        group = move(groups.front());
+        groups.pop_front();
+        changed.notify_all();
+        return true;
+    }
+};
+
+struct ExportChunkIndex {
+    uint32_t rows;
+    vector<pair<uint64_t, uint64_t>> chunks; // offset, size
+};
+
+struct ExportJob {
+    thread worker;
+    atomic<bool> running;
+    atomic<size_t> rowsWritten;
+    size_t totalRows;
+    mutex lock;
+    string result; // shown under the menu once the export ends
+
+    ExportJob() : running(false), rowsWritten(0), totalRows(0) {}
+};
+
+ExportJob exportJob;
+
+// Writer stage: appends each row group to both files and indexes its chunks
+void writeExportGroups(ExportQueue &queue, ofstream &csvFile, ofstream &columnarFile,
+                       vector<ExportChunkIndex> &index) {
+    ExportRowGroup group;
+    while (queue.pop(group)) {
+        csvFile.write(group.csv.data(), group.csv.size());
+        ExportChunkIndex entry;
+        entry.rows = group.rows;
+        for (const string &chunk : group.chunks) {
+            entry.chunks.push_back({static_cast<uint64_t>(columnarFile.tellp()), chunk.size()});
+            columnarFile.write(chunk.data(), chunk.size());
+        }
+        index.push_back(entry);
+        exportJob.rowsWritten += group.rows;
+    }
+}
+
+void writeExportFooter(ofstream &columnarFile, const vector<ExportChunkIndex> &index) {
+    string footer;
+    auto put = [&footer](const auto &value) {
+        footer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+    put(static_cast<uint32_t>(EXPORT_COLUMN_COUNT));
+    for (const auto &column : EXPORT_COLUMNS) {
+        uint32_t length = strlen(column.name);
+        put(length);
+        footer.append(column.name, length);
+        put(static_cast<uint8_t>(column.type));
+    }
+    put(static_cast<uint32_t>(index.size()));
+    for (const auto &entry : index) {
+        put(entry.rows);
+        for (const auto &chunk : entry.chunks) {
+            put(chunk.first);
+            put(chunk.second);
+        }
+    }
+    put(static_cast<uint64_t>(footer.size()));
+    columnarFile.write(footer.data(), footer.size());
+    columnarFile.write(EXPORT_MAGIC, sizeof(EXPORT_MAGIC));
+}
+
+// Encoder stage; runs on exportJob.worker and starts the writer
+void runExport(ExportSnapshot snapshot) {
+    auto start = chrono::steady_clock::now();
+    const string csvPath = EXPORT_DIR + "/customers.csv";
+    const string columnarPath = EXPORT_DIR + "/customers.ebcol";
+    ofstream csvFile(csvPath + ".tmp", ios::binary);
+    ofstream columnarFile(columnarPath + ".tmp", ios::binary);
+
+    string result;
+    if (!csvFile || !columnarFile) {
+        result = "Export failed: cannot create files under " + EXPORT_DIR + "/";
+    } else {
+        for (size_t c = 0; c < EXPORT_COLUMN_COUNT; ++c) {
+            csvFile << (c ? "," : "") << EXPORT_COLUMNS[c].name;
+        }
+        csvFile << "\r\n";
+        columnarFile.write(EXPORT_MAGIC, sizeof(EXPORT_MAGIC));
+
+        ExportQueue queue;
+        vector<ExportChunkIndex> index;
+        thread writer(writeExportGroups, ref(queue), ref(csvFile), ref(columnarFile), ref(index));
+
+        ExportEncoder encoder;
+        ColdFieldReader reader;
+        const vector<ExportRow> &rows = snapshot.rows;
+        for (size_t begin = 0; begin < rows.size(); begin += EXPORT_ROW_GROUP_ROWS) {
+            size_t end = min(rows.size(), begin + EXPORT_ROW_GROUP_ROWS);
+            for (size_t i = begin; i < end; ++i) {
+                encodeExportRow(encoder, rows[i], snapshot, reader);
+            }
+            queue.push(encoder.finish(end - begin));
+        }
+        queue.close();
+        writer.join();
+
+        writeExportFooter(columnarFile, index);
+        csvFile.close();
+        columnarFile.close();
+
+        error_code ec;
+        if (csvFile && columnarFile) {
+            filesystem::rename(csvPath + ".tmp", csvPath, ec);
+            if (!ec) {
+                filesystem::rename(columnarPath + ".tmp", columnarPath, ec);
+            }
+        }
+        if (!csvFile || !columnarFile || ec) {
+            result = "Export failed while writing under " + EXPORT_DIR + "/";
+        } else {
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            ostringstream message;
+            message << fixed << setprecision(1) << "Export finished: " << snapshot.rows.size() << " rows to "
+                    << csvPath << " (" << filesystem::file_size(csvPath) / 1048576.0 << " MB) and "
+                    << columnarPath << " (" << filesystem::file_size(columnarPath) / 1048576.0
+                    << " MB) in " << setprecision(2) << seconds << " s";
+            result = message.str();
+        }
+    }
+
+    lock_guard<mutex> guard(exportJob.lock);
+    exportJob.result = result;
+    exportJob.running = false;
+}
+
+// Waits for an export in flight; needed before the data file is rewritten
+// because the snapshot still reads text fields from it
+void finishExport() {
+    if (!exportJob.worker.joinable()) {
+        return;
+    }
+    if (exportJob.running) {
+        cout << "Waiting for the background export to finish...\n";
+    }
+    exportJob.worker.join();
+}
+
+void printExportStatus() {
+    if (exportJob.running) {
+        size_t total = max<size_t>(1, exportJob.totalRows);
+        cout << "Background export: " << exportJob.rowsWritten * 100 / total << "% ("
+             << exportJob.rowsWritten << " of " << exportJob.totalRows << " rows)\n";
+        return;
+    }
+    lock_guard<mutex> guard(exportJob.lock);
+    if (!exportJob.result.empty()) {
+        cout << exportJob.result << endl;
+        exportJob.result.clear();
+    }
+}
+
+void exportCustomers() {
+    clearScreen();
+    cout << "=== EXPORT CUSTOMER BOOK ===\n\n";
+
+    if (exportJob.running) {
+        cout << "An export is already running (" << exportJob.rowsWritten << " of "
+             << exportJob.totalRows << " rows written).\n";
+        pressEnterToContinue();
+        return;
+    }
+    finishExport();
+
+    error_code ec;
+    filesystem::create_directories(EXPORT_DIR, ec);
+    if (ec) {
+        cout << "Could not create directory " << EXPORT_DIR << ": " << ec.message() << endl;
+        pressEnterToContinue();
+        return;
+    }
+
+    // The snapshot is the consistent view; everything after runs in the background
+    ExportSnapshot snapshot;
+    takeExportSnapshot(snapshot);
+    exportJob.totalRows = customers.size();
+    exportJob.rowsWritten = 0;
+    exportJob.running = true;
+    exportJob.worker = thread(runExport, move(snapshot));
+
+    cout << "Exporting " << customers.size() << " customers in the background to "
+         << EXPORT_DIR << "/customers.csv and " << EXPORT_DIR << "/customers.ebcol.\n";
+    cout << "Progress is shown under the menu.\n";
+    pressEnterToContinue();
+}
+
+// ================= Command Replay =================
+// A command log has one command per line, fields separated by tabs. Tab,
+// newline and backslash inside a field are written as \t, \n and \\.
+// Blank lines and lines starting with # are ignored.
+//
+//   add     name  address  contact  category(1-3)  previous  current
+//   bill    id  current-reading
+//   pay     id
+//   update  id  field(1-6)  value        (fields as in the update menu)
+//   delete  id
+//   search  id|name  value
+//   report
+//   tariff  category(1-3)  rate
+//
+// --record FILE appends every menu action that reaches the store to FILE,
+// once it has taken effect. Cancelled prompts, unknown IDs and changes
+// another operator's edit refused are not recorded. --replay FILE runs a
+// log against the loaded book without prompts and reports per-command
+// latency and checksums of the final state. Replay does not save, and it
+// refuses to run in shared mode, where every change reaches the live store.
+
+enum ReplayCommandType {
+    REPLAY_ADD, REPLAY_BILL, REPLAY_PAY, REPLAY_UPDATE, REPLAY_DELETE, REPLAY_SEARCH, REPLAY_REPORT,
+    REPLAY_TARIFF, REPLAY_COMMAND_COUNT
+};
+
+const char *const REPLAY_COMMAND_NAMES[REPLAY_COMMAND_COUNT] = {
+    "add", "bill", "pay", "update", "delete", "search", "report", "tariff"
+};
+
+const size_t REPLAY_MAX_REPORTED_ERRORS = 20;
+
+// Field count of each command, including the command name
+const size_t REPLAY_COMMAND_FIELDS[REPLAY_COMMAND_COUNT] = {7, 3, 2, 4, 2, 3, 1, 3};
+
+struct ReplayCommand {
+    ReplayCommandType type;
+    vector<string> fields;
+    size_t line;
+};
+
+struct ReplayStats {
+    size_t count;
+    size_t failed;
+    double totalMicros;
+    QuantileSketch latency; // microseconds
+
+    ReplayStats() : count(0), failed(0), totalMicros(0.0) {}
+};
+
+ofstream commandRecorder;
+
+// Shortest text that reads back as the same double
+string formatNumber(double value) {
+    char buffer[32];
+    auto result = to_chars(buffer, buffer + sizeof(buffer), value);
+    return string(buffer, result.ptr);
+}
+
+string escapeCommandField(const string &field) {
+    string escaped;
+    for (char c : field) {
+        switch (c) {
+            case '\\': escaped += "\\\\"; break;
+            case '\t': escaped += "\\t"; break;
+            case '\n': escaped += "\\n"; break;
+            case '\r': escaped += "\\r"; break;
+            default: escaped += c;
+        }
+    }
+    return escaped;
+}
+
+vector<string> splitCommandLine(const string &line) {
+    vector<string> fields(1);
+    for (size_t i = 0; i < line.size(); ++i) {
+        char c = line[i];
+        if (c == '\t') {
+            fields.emplace_back();
+        } else if (c == '\\' && i + 1 < line.size()) {
+            char next = line[++i];
+            fields.back() += next == 't' ? '\t' : next == 'n' ? '\n' : next == 'r' ? '\r' : next;
+        } else {
+            fields.back() += c;
+        }
+    }
+    return fields;
+}
+
+bool startRecording(const string &path) {
+    commandRecorder.open(path, ios::app);
+    if (!commandRecorder) {
+        cout << "Cannot open command log " << path << " for recording.\n";
+        return false;
+    }
+    return true;
+}
+
+void recordCommand(const vector<string> &fields) {
+    if (!commandRecorder.is_open()) {
+        return;
+    }
+    for (size_t i = 0; i < fields.size(); ++i) {
+        commandRecorder << (i ? "\t" : "") << escapeCommandField(fields[i]);
+    }
+    // Flushed per command so a crashed session still leaves a usable log
+    commandRecorder << endl;
+}
+
+bool parseReplayNumber(const string &text, double &value) {
+    auto result = from_chars(text.data(), text.data() + text.size(), value);
+    return result.ec == errc() && result.ptr == text.data() + text.size() && value >= 0;
+}
+
+bool parseReplayInt(const string &text, int &value) {
+    auto result = from_chars(text.data(), text.data() + text.size(), value);
+    return result.ec == errc() && result.ptr == text.data() + text.size() && value >= 0;
+}
+
+// Checks field counts and values up front so replay timing covers only the
+// store operations
+bool parseReplayCommand(const vector<string> &fields, ReplayCommand &command, string &error) {
+    int type = 0;
+    while (type < REPLAY_COMMAND_COUNT && fields[0] != REPLAY_COMMAND_NAMES[type]) {
+        type++;
+    }
+    if (type == REPLAY_COMMAND_COUNT) {
+        error = "unknown command '" + fields[0] + "'";
+        return false;
+    }
+    command.type = static_cast<ReplayCommandType>(type);
+    if (fields.size() != REPLAY_COMMAND_FIELDS[type]) {
+        error = fields[0] + " expects " + to_string(REPLAY_COMMAND_FIELDS[type] - 1) + " argument(s)";
+        return false;
+    }
+    command.fields = fields;
+
+    int id, number;
+    double amount;
+    switch (command.type) {
+        case REPLAY_ADD:
+            if (!parseReplayInt(fields[4], number) || number < 1 || number > CATEGORY_COUNT ||
+                !parseReplayNumber(fields[5], amount) || !parseReplayNumber(fields[6], amount)) {
+                error = "add expects category 1-3 and non-negative readings";
+                return false;
+            }
+            break;
+        case REPLAY_BILL:
+            if (!parseReplayInt(fields[1], id) || !parseReplayNumber(fields[2], amount)) {
+                error = "bill expects an ID and a non-negative reading";
+                return false;
+            }
+            break;
+        case REPLAY_UPDATE:
+            if (!parseReplayInt(fields[1], id) || !parseReplayInt(fields[2], number) || number < 1 || number > 6) {
+                error = "update expects an ID and a field number 1-6";
+                return false;
+            }
+            if ((number == 4 || number == 5) && !parseReplayNumber(fields[3], amount)) {
+                error = "update expects a non-negative reading";
+                return false;
+            }
+            if (number == 6 && (!parseReplayInt(fields[3], id) || id < 1 || id > CATEGORY_COUNT)) {
+                error = "update expects category 1-3";
+                return false;
+            }
+            break;
+        case REPLAY_PAY:
+        case REPLAY_DELETE:
+            if (!parseReplayInt(fields[1], id)) {
+                error = fields[0] + " expects a customer ID";
+                return false;
+            }
+            break;
+        case REPLAY_SEARCH:
+            if (fields[1] != "name" && (fields[1] != "id" || !parseReplayInt(fields[2], id))) {
+                error = "search expects 'id <number>' or 'name <text>'";
+                return false;
+            }
+            break;
+        case REPLAY_TARIFF:
+            if (!parseReplayInt(fields[1], number) || number < 1 || number > CATEGORY_COUNT ||
+                !parseReplayNumber(fields[2], amount)) {
+                error = "tariff expects category 1-3 and a non-negative rate";
+                return false;
+            }
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+// Runs one command against the book; false when it found nothing to act
+// on or its commit was refused
+bool executeReplayCommand(const ReplayCommand &command, ReportTotals &lastReport) {
+    const vector<string> &f = command.fields;
+    size_t index = CUSTOMER_NOT_FOUND;
+    if (command.type != REPLAY_ADD && command.type != REPLAY_REPORT && command.type != REPLAY_SEARCH &&
+        command.type != REPLAY_TARIFF) {
+        index = findCustomer(atoi(f[1].c_str()));
+        if (index == CUSTOMER_NOT_FOUND) {
+            return false;
+        }
+    }
+
+    switch (command.type) {
+        case REPLAY_ADD: {
+            Customer customer;
+            customer.customerID = generateCustomerID();
+            customer.name = f[1];
+            customer.address = f[2];
+            customer.contact = f[3];
+            customer.category = atoi(f[4].c_str()) - 1;
+            customer.previousReading = strtod(f[5].c_str(), nullptr);
+            customer.currentReading = strtod(f[6].c_str(), nullptr);
+            return insertCustomer(customer);
+        }
+        case REPLAY_BILL:
+            return billCustomer(index, strtod(f[2].c_str(), nullptr));
+        case REPLAY_PAY:
+            return !customers[index].isPaid && payCustomer(index);
+        case REPLAY_UPDATE:
+            return updateCustomerField(index, atoi(f[2].c_str()), f[3]);
+        case REPLAY_DELETE:
+            return deleteCustomerRecord(index);
+        case REPLAY_SEARCH:
+            if (f[1] == "id") {
+                // The menu shows the full record, so fetch its text fields too
+                index = findCustomer(atoi(f[2].c_str()));
+                if (index == CUSTOMER_NOT_FOUND) {
+                    return false;
+                }
+                coldFields(customers[index]);
+                return true;
+            }
+            return !searchCustomersByName(f[2]).empty();
+        case REPLAY_REPORT:
+            lastReport = computeReportTotals();
+            return true;
+        case REPLAY_TARIFF:
+            setTariffRate(atoi(f[1].c_str()), strtod(f[2].c_str(), nullptr));
+            return true;
+        default:
+            return false;
+    }
+}
+
+// FNV-1a over every field of every customer in book order, so two runs
+// agree only if they end with identical books
+uint64_t fnv1a(uint64_t hash, const void *data, size_t size) {
+    const unsigned char *bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+const uint64_t FNV_OFFSET_BASIS = 0xCBF29CE484222325ULL;
+
+uint64_t bookChecksum() {
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for (const auto &customer : customers) {
+        ColdFields fields = coldFields(customer);
+        const string *texts[] = {&fields.name, &fields.address, &fields.contact,
+                                 &customer.billingDate, &customer.dueDate};
+        for (const string *text : texts) {
+            uint64_t length = text->size();
+            hash = fnv1a(hash, &length, sizeof(length));
+            hash = fnv1a(hash, text->data(), text->size());
+        }
+        for (double value : {customer.previousReading, customer.currentReading, customer.unitsConsumed,
+                             customer.billAmount, customer.lateFee}) {
+            hash = fnv1a(hash, &value, sizeof(value));
+        }
+        int32_t values[] = {customer.customerID, customer.isPaid ? 1 : 0, customer.dunningLevel, customer.category};
+        hash = fnv1a(hash, values, sizeof(values));
+    }
+    return hash;
+}
+
+uint64_t tariffChecksum() {
+    double rates[] = {currentTariff.domesticRate, currentTariff.commercialRate, currentTariff.industrialRate};
+    return fnv1a(FNV_OFFSET_BASIS, rates, sizeof(rates));
+}
+
+// rate is commands per second; 0 runs at full speed
+int runReplay(const string &path, double rate) {
+    ifstream log(path);
+    if (!log) {
+        cout << "Cannot open command log " << path << endl;
+        return 1;
+    }
+
+    vector<ReplayCommand> commands;
+    size_t skipped = 0;
+    string line;
+    for (size_t lineNumber = 1; getline(log, line); ++lineNumber) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        ReplayCommand command;
+        string error;
+        if (!parseReplayCommand(splitCommandLine(line), command, error)) {
+            if (skipped < REPLAY_MAX_REPORTED_ERRORS) {
+                cout << path << ":" << lineNumber << ": " << error << " (skipped)\n";
+            }
+            skipped++;
+            continue;
+        }
+        command.line = lineNumber;
+        commands.push_back(command);
+    }
+
+    vector<ReplayStats> stats(REPLAY_COMMAND_COUNT);
+    ReportTotals lastReport = {0, 0, 0.0, 0.0};
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < commands.size(); ++i) {
+        if (rate > 0) {
+            this_thread::sleep_until(start + chrono::duration_cast<chrono::steady_clock::duration>(
+                                                 chrono::duration<double>(i / rate)));
+        }
+        auto begin = chrono::steady_clock::now();
+        bool ok = executeReplayCommand(commands[i], lastReport);
+        double micros = chrono::duration<double, micro>(chrono::steady_clock::now() - begin).count();
+
+        ReplayStats &s = stats[commands[i].type];
+        s.count++;
+        s.failed += ok ? 0 : 1;
+        s.totalMicros += micros;
+        s.latency.add(micros);
+    }
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    lastReport = computeReportTotals();
+
+    cout << "\nReplayed " << commands.size() << " command(s) from " << path;
+    if (skipped) {
+        cout << " (" << skipped << " line(s) skipped)";
+    }
+    cout << fixed << setprecision(1) << " in " << elapsed * 1000 << " ms";
+    if (elapsed > 0) {
+        cout << ", " << commands.size() / elapsed << " commands/s";
+    }
+    cout << "\n\n";
+
+    cout << left << setw(10) << "Command" << right << setw(10) << "Count" << setw(10) << "Failed"
+         << setw(12) << "Mean (us)" << setw(12) << "p50 (us)" << setw(12) << "p99 (us)"
+         << setw(12) << "Max (us)" << endl;
+    cout << string(78, '-') << endl;
+    for (int type = 0; type < REPLAY_COMMAND_COUNT; ++type) {
+        const ReplayStats &s = stats[type];
+        if (s.count == 0) {
+            continue;
+        }
+        cout << left << setw(10) << REPLAY_COMMAND_NAMES[type] << right << setw(10) << s.count
+             << setw(10) << s.failed << setw(12) << s.totalMicros / s.count
+             << setw(12) << s.latency.quantile(0.5) << setw(12) << s.latency.quantile(0.99)
+             << setw(12) << s.latency.maxValue << endl;
+    }
+    cout << string(78, '-') << endl;
+
+    cout << "\nFinal state:\n";
+    cout << "Customers: " << customers.size() << endl;
+    cout << "Paid / pending bills: " << lastReport.paidBills << " / " << lastReport.pendingBills << endl;
+    cout << setprecision(2) << "Revenue / pending amount: Rs. " << lastReport.totalRevenue
+         << " / Rs. " << lastReport.totalPending << endl;
+    cout << hex << setfill('0');
+    cout << "Book checksum:   0x" << setw(16) << bookChecksum() << endl;
+    cout << "Tariff checksum: 0x" << setw(16) << tariffChecksum() << endl;
+    cout << dec << setfill(' ');
+    return 0;
+}
+
+// ================= Record Storage =================
+// customers.dat (format 5) is a header, the locality dictionary, the hot
+// parts of every block, the cold parts of every block, then a block index
+// and its offset. A block covers BLOCK_RECORDS customers. Its hot part holds
+// IDs, readings, amounts, dates and status; its cold part holds name,
+// address and contact. Each part is varint-encoded and compressed on its
+// own, so any block can be decoded without its neighbours.
+//
+// Startup reads the hot parts in one go and decodes them in parallel. Cold
+// parts stay on disk until a text field is needed, and decoded cold blocks
+// are then kept in a small LRU cache. A customer created or edited in this
+// session is "resident": its text fields live in the Customer itself
+// (coldRef < 0). Otherwise coldRef is the record's position in the file.
+
+const size_t BLOCK_RECORDS = 4096;
+const size_t COLD_CACHE_BLOCKS = 16;
+const size_t HOT_RECORDS_PER_READ = 65536; // format 3/4 loader
+const string DAMAGED_TEXT = "[damaged]";    // shown for text that cannot be decoded
+
+struct DataBlock {
+    uint64_t hotOffset;
+    uint64_t coldOffset;
+    uint32_t records;
+    uint32_t hotSize;     // compressed bytes on disk
+    uint32_t hotRawSize;  // bytes after decompression
+    uint32_t coldSize;
+    uint32_t coldRawSize;
+};
+
+// Cold fields of one block. Addresses that end in their locality are kept
+// without it; coldFields() puts it back from the dictionary.
+struct ColdBlock {
+    vector<ColdFields> records;
+    vector<uint8_t> localitySuffix;
+};
+
+struct ColdCache {
+    mutex lock;
+    ifstream file; // customers.dat, open while any record is not resident
+    vector<DataBlock> blocks; // block index of that file
+    vector<bool> damaged;     // per block, set once its text failed to decode
+    list<pair<size_t, shared_ptr<ColdBlock>>> entries; // most recently used first
+    unordered_map<size_t, list<pair<size_t, shared_ptr<ColdBlock>>>::iterator> index;
+};
+
+ColdCache coldCache;
+
+// ---- Varints and block compression ----
+
+// 7 bits per byte, low bits first; the high bit marks that more bytes follow
+void putVarint(string &out, uint64_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+uint64_t zigzag(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+void putText(string &out, const string &text) {
+    putVarint(out, text.size());
+    out += text;
+}
+
+// Amounts in whole paise are stored as a varint (low bit 0); anything else
+// keeps all 8 bytes of the double (tag 1)
+void putAmount(string &out, double value) {
+    double scaled = value * 100.0;
+    if (fabs(scaled) < 1e15) {
+        int64_t paise = llround(scaled);
+        if (paise / 100.0 == value) {
+            putVarint(out, zigzag(paise) << 1);
+            return;
+        }
+    }
+    putVarint(out, 1);
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// 0 = empty, 1 = text that is not a plain date, otherwise days since epoch + 2
+void putDate(string &out, const string &date) {
+    int days = daysFromDate(date);
+    if (days >= 0 && dateFromDays(days) == date) {
+        putVarint(out, static_cast<uint64_t>(days) + 2);
+    } else if (date.empty()) {
+        putVarint(out, 0);
+    } else {
+        putVarint(out, 1);
+        putText(out, date);
+    }
+}
+
+// Bounds-checked reader over a decoded block; ok turns false on a short or
+// malformed buffer and every later read returns zero values
+struct ByteReader {
+    const char *pos;
+    const char *end;
+    bool ok;
+
+    ByteReader(const string &data) : pos(data.data()), end(data.data() + data.size()), ok(true) {}
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64 && pos < end; shift += 7) {
+            uint8_t byte = *pos++;
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+        ok = false;
+        return 0;
+    }
+
+    uint8_t byte() {
+        if (pos >= end) {
+            ok = false;
+            return 0;
+        }
+        return *pos++;
+    }
+
+    string bytes(size_t length) {
+        if (static_cast<size_t>(end - pos) < length) {
+            ok = false;
+            return string();
+        }
+        string text(pos, length);
+        pos += length;
+        return text;
+    }
+
+    string text() {
+        return bytes(varint());
+    }
+
+    double amount() {
+        uint64_t tag = varint();
+        if (!(tag & 1)) {
+            return unzigzag(tag >> 1) / 100.0;
+        }
+        double value = 0.0;
+        string raw = bytes(sizeof(value));
+        if (ok) {
+            memcpy(&value, raw.data(), sizeof(value));
+        }
+        return value;
+    }
+
+    string date() {
+        uint64_t tag = varint();
+        if (tag == 0) {
+            return string();
+        }
+        return tag == 1 ? text() : dateFromDays(static_cast<int>(tag - 2));
+    }
+};
+
+// LZ77 in the style of LZ4: each sequence is a token (literal count in the
+// high nibble, match length - LZ_MIN_MATCH in the low nibble, 15 meaning
+// more length bytes follow), the literals, then a 2-byte match offset. The
+// final sequence has literals only.
+const size_t LZ_MIN_MATCH = 4;
+const size_t LZ_MAX_OFFSET = 65535;
+const int LZ_HASH_BITS = 14;
+
+void lzPutLength(string &out, size_t length) {
+    for (; length >= 255; length -= 255) {
+        out += static_cast<char>(255);
+    }
+    out += static_cast<char>(length);
+}
+
+void lzPutSequence(string &out, const string &input, size_t literalStart, size_t literals,
+                   size_t matchLength, size_t offset) {
+    size_t matchExtra = matchLength ? matchLength - LZ_MIN_MATCH : 0;
+    out += static_cast<char>((min<size_t>(literals, 15) << 4) | min<size_t>(matchExtra, 15));
+    if (literals >= 15) {
+        lzPutLength(out, literals - 15);
+    }
+    out.append(input, literalStart, literals);
+    if (matchLength) {
+        out += static_cast<char>(offset & 0xFF);
+        out += static_cast<char>(offset >> 8);
+        if (matchExtra >= 15) {
+            lzPutLength(out, matchExtra - 15);
+        }
+    }
+}
+
+string lzCompress(const string &input) {
+    string out;
+    out.reserve(input.size() / 2 + 16);
+    vector<uint32_t> table(1u << LZ_HASH_BITS, UINT32_MAX);
+    const unsigned char *src = reinterpret_cast<const unsigned char*>(input.data());
+    size_t size = input.size();
+    size_t anchor = 0;
+    size_t pos = 0;
+
+    while (pos + LZ_MIN_MATCH <= size) {
+        uint32_t sequence;
+        memcpy(&sequence, src + pos, sizeof(sequence));
+        uint32_t slot = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+        uint32_t candidate = table[slot];
+        table[slot] = pos;
+
+        if (candidate == UINT32_MAX || pos - candidate > LZ_MAX_OFFSET ||
+            memcmp(src + candidate, src + pos, LZ_MIN_MATCH) != 0) {
+            ++pos;
+            continue;
+        }
+
+        size_t length = LZ_MIN_MATCH;
+        while (pos + length < size && src[candidate + length] == src[pos + length]) {
+            ++length;
+        }
+        lzPutSequence(out, input, anchor, pos - anchor, length, pos - candidate);
+        pos += length;
+        anchor = pos;
+    }
+
+    lzPutSequence(out, input, anchor, size - anchor, 0, 0);
+    return out;
+}
+
+bool lzReadLength(const string &data, size_t &pos, size_t &length) {
+    uint8_t byte;
+    do {
+        if (pos >= data.size()) {
+            return false;
+        }
+        byte = data[pos++];
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+bool lzDecompress(const string &data, size_t rawSize, string &out) {
+    out.resize(rawSize);
+    char *dst = &out[0];
+    size_t written = 0;
+    size_t pos = 0;
+    while (pos < data.size()) {
+        uint8_t token = data[pos++];
+        size_t literals = token >> 4;
+        if (literals == 15 && !lzReadLength(data, pos, literals)) {
+            return false;
+        }
+        if (literals > data.size() - pos || literals > rawSize - written) {
+            return false;
+        }
+        memcpy(dst + written, data.data() + pos, literals);
+        written += literals;
+        pos += literals;
+        if (pos == data.size()) {
+            break;
+        }
+
+        if (pos + 2 > data.size()) {
+            return false;
+        }
+        size_t offset = static_cast<uint8_t>(data[pos]) | static_cast<uint8_t>(data[pos + 1]) << 8;
+        pos += 2;
+        size_t length = token & 15;
+        if (length == 15 && !lzReadLength(data, pos, length)) {
+            return false;
+        }
+        length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > written || length > rawSize - written) {
+            return false;
+        }
+        // A match may overlap the bytes it is producing; copy those byte by byte
+        const char *from = dst + written - offset;
+        if (offset >= length) {
+            memcpy(dst + written, from, length);
+        } else {
+            for (size_t i = 0; i < length; ++i) {
+                dst[written + i] = from[i];
+            }
+        }
+        written += length;
+    }
+    return written == rawSize;
+}
+
+// ---- Block encoding ----
+
+void encodeHotRecord(string &out, const Customer &customer, int &previousID) {
+    putVarint(out, zigzag(static_cast<int64_t>(customer.customerID) - previousID));
+    previousID = customer.customerID;
+    out += static_cast<char>((customer.isPaid ? 1 : 0) | customer.category << 1);
+    putVarint(out, customer.localityID);
+    putVarint(out, zigzag(customer.dunningLevel));
+    putAmount(out, customer.previousReading);
+    putAmount(out, customer.currentReading);
+    putAmount(out, customer.unitsConsumed);
+    putAmount(out, customer.billAmount);
+    putAmount(out, customer.lateFee);
+    putDate(out, customer.billingDate);
+    putDate(out, customer.dueDate);
+}
+
+void decodeHotRecord(ByteReader &in, Customer &customer, int &previousID) {
+    customer.customerID = previousID + static_cast<int>(unzigzag(in.varint()));
+    previousID = customer.customerID;
+    uint8_t flags = in.byte();
+    customer.isPaid = flags & 1;
+    customer.category = (flags >> 1) < CATEGORY_COUNT ? flags >> 1 : static_cast<int>(CATEGORY_DOMESTIC);
+    uint64_t localityID = in.varint();
+    customer.localityID = localityID < localityNames.size() ? localityID : 0;
+    customer.dunningLevel = static_cast<int>(unzigzag(in.varint()));
+    customer.previousReading = in.amount();
+    customer.currentReading = in.amount();
+    customer.unitsConsumed = in.amount();
+    customer.billAmount = in.amount();
+    customer.lateFee = in.amount();
+    customer.billingDate = in.date();
+    customer.dueDate = in.date();
+}
+
+// The locality at the end of an address is already in the dictionary, so
+// only the part before ", <locality>" is stored when it matches exactly
+void encodeColdRecord(string &out, const Customer &customer, const ColdFields &fields) {
+    putText(out, fields.name);
+
+    const string &address = fields.address;
+    const string &locality = localityNames[customer.localityID];
+    size_t suffix = locality.size() + 2;
+    bool fromDictionary = customer.localityID != 0 && address.size() >= suffix &&
+                          address.compare(address.size() - suffix, 2, ", ") == 0 &&
+                          address.compare(address.size() - locality.size(), locality.size(), locality) == 0;
+    size_t stored = fromDictionary ? address.size() - suffix : address.size();
+    putVarint(out, stored << 1 | (fromDictionary ? 1 : 0));
+    out.append(address, 0, stored);
+
+    putText(out, fields.contact);
+}
+
+bool decodeColdBlock(const string &raw, uint32_t records, ColdBlock &block) {
+    ByteReader in(raw);
+    block.records.resize(records);
+    block.localitySuffix.resize(records);
+    for (uint32_t i = 0; i < records && in.ok; ++i) {
+        ColdFields &fields = block.records[i];
+        fields.name = in.text();
+        uint64_t addressTag = in.varint();
+        fields.address = in.bytes(addressTag >> 1);
+        block.localitySuffix[i] = addressTag & 1;
+        fields.contact = in.text();
+    }
+    return in.ok;
+}
+
+// ---- Cold field access ----
+
+// Caller holds coldCache.lock
+shared_ptr<ColdBlock> readColdBlock(size_t blockIndex) {
+    auto block = make_shared<ColdBlock>();
+    if (blockIndex >= coldCache.blocks.size()) {
+        return block;
+    }
+    const DataBlock &info = coldCache.blocks[blockIndex];
+    string compressed(info.coldSize, '\0');
+    string raw;
+    coldCache.file.clear();
+    coldCache.file.seekg(info.coldOffset);
+    coldCache.file.read(&compressed[0], compressed.size());
+    if (!coldCache.file || !lzDecompress(compressed, info.coldRawSize, raw) ||
+        !decodeColdBlock(raw, info.records, *block)) {
+        cout << "Warning: text fields of block " << blockIndex << " in " << DATA_FILE << " are damaged.\n";
+        block->records.assign(info.records, {DAMAGED_TEXT, DAMAGED_TEXT, DAMAGED_TEXT});
+        block->localitySuffix.assign(info.records, 0);
+        coldCache.damaged.resize(coldCache.blocks.size());
+        coldCache.damaged[blockIndex] = true;
+    }
+    return block;
+}
+
+// Blocks read so far whose text is only a placeholder. Nothing may be saved
+// or shared from the book while any are, or the original text would be lost.
+size_t damagedColdBlocks() {
+    lock_guard<mutex> guard(coldCache.lock);
+    return count(coldCache.damaged.begin(), coldCache.damaged.end(), true);
+}
+
+// Returns the block from the cache, reading it on a miss. The lock is only
+// held for the lookup; callers copy fields out of the returned block.
+shared_ptr<ColdBlock> cachedColdBlock(size_t blockIndex) {
+    lock_guard<mutex> guard(coldCache.lock);
+    auto found = coldCache.index.find(blockIndex);
+    if (found != coldCache.index.end()) {
+        coldCache.entries.splice(coldCache.entries.begin(), coldCache.entries, found->second);
+    } else {
+        coldCache.entries.emplace_front(blockIndex, readColdBlock(blockIndex));
+        coldCache.index[blockIndex] = coldCache.entries.begin();
+        if (coldCache.entries.size() > COLD_CACHE_BLOCKS) {
+            coldCache.index.erase(coldCache.entries.back().first);
+            coldCache.entries.pop_back();
+        }
+    }
+    return coldCache.entries.front().second;
+}
+
+// The dictionary may grow on the menu thread while another thread reads
+string localitySuffix(uint32_t localityID) {
+    lock_guard<mutex> guard(coldCache.lock);
+    return ", " + localityNames[localityID];
+}
+
+ColdFields coldFields(const Customer &customer) {
+    if (customer.coldRef < 0) {
+        return {customer.name, customer.address, customer.contact};
+    }
+
+    size_t slot = customer.coldRef % BLOCK_RECORDS;
+    shared_ptr<ColdBlock> block = cachedColdBlock(customer.coldRef / BLOCK_RECORDS);
+    if (slot >= block->records.size()) {
+        return ColdFields();
+    }
+    ColdFields fields = block->records[slot];
+    if (block->localitySuffix[slot]) {
+        fields.address += localitySuffix(customer.localityID);
+    }
+    return fields;
+}
+
+string ColdFieldReader::read(const Customer &customer, ColdField field) {
+    if (customer.coldRef < 0) {
+        return field == COLD_NAME ? customer.name : field == COLD_ADDRESS ? customer.address : customer.contact;
+    }
+    return read(customer.coldRef, customer.localityID, field);
+}
+
+// coldRef must refer to a record on disk
+string ColdFieldReader::read(int64_t coldRef, uint32_t localityID, ColdField field) {
+    size_t index = coldRef / BLOCK_RECORDS;
+    size_t slot = coldRef % BLOCK_RECORDS;
+    if (index != blockIndex) {
+        block = cachedColdBlock(index);
+        blockIndex = index;
+    }
+    if (slot >= block->records.size()) {
+        return string();
+    }
+    const ColdFields &fields = block->records[slot];
+    if (field == COLD_NAME) {
+        return fields.name;
+    }
+    if (field == COLD_CONTACT) {
+        return fields.contact;
+    }
+    return block->localitySuffix[slot] ? fields.address + localitySuffix(localityID) : fields.address;
+}
+
+string customerName(const Customer &customer) {
+    return ColdFieldReader().read(customer, COLD_NAME);
+}
+
+string customerAddress(const Customer &customer) {
+    return ColdFieldReader().read(customer, COLD_ADDRESS);
+}
+
+string customerContact(const Customer &customer) {
+    return ColdFieldReader().read(customer, COLD_CONTACT);
+}
+
+// Pulls the text fields into the record so they can be edited in place
+void makeResident(Customer &customer) {
+    if (customer.coldRef < 0) {
+        return;
+    }
+    ColdFields fields = coldFields(customer);
+    customer.name = fields.name;
+    customer.address = fields.address;
+    customer.contact = fields.contact;
+    customer.coldRef = -1;
+}
+
+void resetColdCache() {
+    lock_guard<mutex> guard(coldCache.lock);
+    coldCache.entries.clear();
+    coldCache.index.clear();
+    coldCache.blocks.clear();
+    coldCache.damaged.clear();
+    if (coldCache.file.is_open()) {
+        coldCache.file.close();
+    }
+}
+
+// ---- Writing ----
+
+void writeDataHeader(ofstream &outFile, uint32_t version) {
+    // Versioned header: magic, format version, dunning clock, record count
+    size_t count = customers.size();
+    outFile.write(reinterpret_cast<const char*>(&DATA_FILE_MAGIC), sizeof(DATA_FILE_MAGIC));
+    outFile.write(reinterpret_cast<const char*>(&version), sizeof(version));
+    outFile.write(reinterpret_cast<const char*>(&dunningClock), sizeof(dunningClock));
+    outFile.write(reinterpret_cast<const char*>(&count), sizeof(count));
+}
+
+// Writes the customer book in format 5 and returns its block index
+bool writeCompactFile(const string &path, vector<DataBlock> &blocks) {
+    ofstream outFile(path, ios::binary);
+    if (!outFile) {
+        return false;
+    }
+    writeDataHeader(outFile, DATA_FILE_VERSION);
+
+    string buffer;
+    putVarint(buffer, localityNames.size());
+    for (const auto &locality : localityNames) {
+        putText(buffer, locality);
+    }
+    outFile.write(buffer.data(), buffer.size());
+
+    size_t count = customers.size();
+    blocks.assign((count + BLOCK_RECORDS - 1) / BLOCK_RECORDS, DataBlock());
+
+    // All hot parts first so startup can read them in a single request
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        size_t begin = b * BLOCK_RECORDS;
+        size_t end = min(count, begin + BLOCK_RECORDS);
+        int previousID = 0;
+        buffer.clear();
+        for (size_t i = begin; i < end; ++i) {
+            encodeHotRecord(buffer, customers[i], previousID);
+        }
+        string compressed = lzCompress(buffer);
+        DataBlock &info = blocks[b];
+        info.hotOffset = outFile.tellp();
+        info.records = end - begin;
+        info.hotSize = compressed.size();
+        info.hotRawSize = buffer.size();
+        outFile.write(compressed.data(), compressed.size());
+    }
+
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        size_t begin = b * BLOCK_RECORDS;
+        size_t end = min(count, begin + BLOCK_RECORDS);
+        buffer.clear();
+        for (size_t i = begin; i < end; ++i) {
+            encodeColdRecord(buffer, customers[i], coldFields(customers[i]));
+        }
+        string compressed = lzCompress(buffer);
+        DataBlock &info = blocks[b];
+        info.coldOffset = outFile.tellp();
+        info.coldSize = compressed.size();
+        info.coldRawSize = buffer.size();
+        outFile.write(compressed.data(), compressed.size());
+    }
+
+    // Block index, then where it starts as the last 8 bytes of the file
+    uint64_t indexOffset = outFile.tellp();
+    buffer.clear();
+    putVarint(buffer, blocks.size());
+    for (const auto &info : blocks) {
+        for (uint64_t field : {info.hotOffset, info.coldOffset, uint64_t(info.records), uint64_t(info.hotSize),
+                               uint64_t(info.hotRawSize), uint64_t(info.coldSize), uint64_t(info.coldRawSize)}) {
+            putVarint(buffer, field);
+        }
+    }
+    outFile.write(buffer.data(), buffer.size());
+    outFile.write(reinterpret_cast<const char*>(&indexOffset), sizeof(indexOffset));
+
+    outFile.close();
+    return static_cast<bool>(outFile);
+}
+
+// Format 4 layout: fixed-size hot records followed by length-prefixed text.
+// Only written by --compare-formats.
+struct HotRecord {
+    int32_t customerID;
+    int32_t dunningLevel;
+    double previousReading;
+    double currentReading;
+    double unitsConsumed;
+    double billAmount;
+    double lateFee;
+    int64_t coldOffset;
+    char billingDate[12];
+    char dueDate[12];
+    uint8_t isPaid;
+    uint8_t category;    // added in format 4
+    uint32_t localityID; // added in format 4
+};
+
+// Format 3 records had the same size; their zeroed padding reads back as
+// the domestic category and an unknown locality
+static_assert(sizeof(HotRecord) == 88, "HotRecord layout is part of the file format");
+
+template <size_t N>
+void copyDateField(char (&field)[N], const string &value) {
+    memset(field, 0, N);
+    memcpy(field, value.data(), min(value.size(), N - 1));
+}
+
+HotRecord hotRecordFrom(const Customer &customer, int64_t coldOffset) {
+    HotRecord record;
+    memset(&record, 0, sizeof(record));
+    record.customerID = customer.customerID;
+    record.dunningLevel = customer.dunningLevel;
+    record.previousReading = customer.previousReading;
+    record.currentReading = customer.currentReading;
+    record.unitsConsumed = customer.unitsConsumed;
+    record.billAmount = customer.billAmount;
+    record.lateFee = customer.lateFee;
+    record.coldOffset = coldOffset;
+    copyDateField(record.billingDate, customer.billingDate);
+    copyDateField(record.dueDate, customer.dueDate);
+    record.isPaid = customer.isPaid ? 1 : 0;
+    record.category = customer.category;
+    record.localityID = customer.localityID;
+    return record;
+}
+
+Customer customerFromHotRecord(const HotRecord &record) {
+    Customer customer;
+    customer.customerID = record.customerID;
+    customer.dunningLevel = record.dunningLevel;
+    customer.previousReading = record.previousReading;
+    customer.currentReading = record.currentReading;
+    customer.unitsConsumed = record.unitsConsumed;
+    customer.billAmount = record.billAmount;
+    customer.lateFee = record.lateFee;
+    customer.billingDate = record.billingDate;
+    customer.dueDate = record.dueDate;
+    customer.isPaid = record.isPaid != 0;
+    customer.category = record.category < CATEGORY_COUNT ? record.category : static_cast<int>(CATEGORY_DOMESTIC);
+    customer.localityID = record.localityID < localityNames.size() ? record.localityID : 0;
+    return customer;
+}
+
+bool writeHotColdFile(const string &path) {
+    ofstream outFile(path, ios::binary);
+    if (!outFile) {
+        return false;
+    }
+    writeDataHeader(outFile, 4);
+
+    uint32_t localityCount = localityNames.size();
+    outFile.write(reinterpret_cast<const char*>(&localityCount), sizeof(localityCount));
+    for (const auto &locality : localityNames) {
+        uint32_t length = locality.size();
+        outFile.write(reinterpret_cast<const char*>(&length), sizeof(length));
+        outFile.write(locality.data(), length);
+    }
+
+    // Cold text is streamed first so its offsets are known when the hot
+    // section is filled in afterwards
+    size_t count = customers.size();
+    streamoff hotStart = outFile.tellp();
+    outFile.seekp(hotStart + static_cast<streamoff>(count * sizeof(HotRecord)));
+    vector<int64_t> coldOffsets(count);
+    for (size_t i = 0; i < count; ++i) {
+        coldOffsets[i] = outFile.tellp();
+        ColdFields fields = coldFields(customers[i]);
+        for (const string *text : {&fields.name, &fields.address, &fields.contact}) {
+            uint32_t length = text->size();
+            outFile.write(reinterpret_cast<const char*>(&length), sizeof(length));
+            outFile.write(text->data(), length);
+        }
+    }
+
+    outFile.seekp(hotStart);
+    vector<HotRecord> batch;
+    for (size_t start = 0; start < count; start += HOT_RECORDS_PER_READ) {
+        size_t end = min(count, start + HOT_RECORDS_PER_READ);
+        batch.clear();
+        for (size_t i = start; i < end; ++i) {
+            batch.push_back(hotRecordFrom(customers[i], coldOffsets[i]));
+        }
+        outFile.write(reinterpret_cast<const char*>(batch.data()), batch.size() * sizeof(HotRecord));
+    }
+
+    outFile.close();
+    return static_cast<bool>(outFile);
+}
+
+bool saveData() {
+    // An export in flight still reads text fields from the current file
+    finishExport();
+    
+    // Operators sharing a directory take turns writing the file, each with
+    // everything the others have committed so far
+    int lockFd = lockDataFile();
+    syncFromSharedStore();
+
+    // Cold fields of untouched customers are still read from the current
+    // file, so write a new file and swap it in afterwards
+    string tempFile = DATA_FILE + ".tmp";
+    vector<DataBlock> blocks;
+    if (!writeCompactFile(tempFile, blocks)) {
+        cout << "Error saving data to file!\n";
+        unlockDataFile(lockFd);
+        return false;
+    }
+    // Writing the file read every block, so any damage is known by now
+    error_code ec;
+    if (size_t damaged = damagedColdBlocks()) {
+        cout << "Not saved: the text of " << damaged << " block(s) in " << DATA_FILE
+             << " is damaged and would be replaced with placeholders.\n";
+        filesystem::remove(tempFile, ec);
+        unlockDataFile(lockFd);
+        return false;
+    }
+
+#ifdef _WIN32
+    // Windows cannot replace a file that is open
+    {
+        lock_guard<mutex> guard(coldCache.lock);
+        coldCache.file.close();
+    }
+#endif
+    filesystem::rename(tempFile, DATA_FILE, ec);
+    if (ec) {
+        // Records that are not resident still point into the old file, so
+        // keep reading it with its own block index and cached blocks
+        cout << "Error replacing " << DATA_FILE << ": " << ec.message() << endl;
+        cout << "The new data was left in " << tempFile << "." << endl;
+        lock_guard<mutex> guard(coldCache.lock);
+        if (!coldCache.file.is_open() && !coldCache.blocks.empty()) {
+            coldCache.file.open(DATA_FILE, ios::binary);
+        }
+        unlockDataFile(lockFd);
+        return false;
+    }
+
+    recordDataFileSaved();
+    resetColdCache();
+    // Everything is on disk now, so drop the in-memory text fields
+    for (size_t i = 0; i < customers.size(); ++i) {
+        Customer &customer = customers[i];
+        customer.coldRef = i;
+        string().swap(customer.name);
+        string().swap(customer.address);
+        string().swap(customer.contact);
+    }
+
+    lock_guard<mutex> guard(coldCache.lock);
+    coldCache.file.open(DATA_FILE, ios::binary);
+    coldCache.blocks = blocks;
+    unlockDataFile(lockFd);
+    return true;
+}
+
+// ---- Reading ----
+
+bool readLocalityDictionary(ByteReader &in) {
+    uint64_t localityCount = in.varint();
+    localityNames.clear();
+    localityIndex.clear();
+    for (uint64_t i = 0; i < localityCount && in.ok; ++i) {
+        string locality = in.text();
+        localityIndex[toLowerCopy(locality)] = localityNames.size();
+        localityNames.push_back(locality);
+    }
+    if (localityNames.empty()) {
+        localityNames.push_back("Unknown");
+    }
+    return in.ok;
+}
+
+// Format 5: reads the dictionary and the block index, then decodes the hot
+// parts in parallel. inFile is positioned just past the header.
+bool loadCompactFile(ifstream &inFile, const string &path, size_t count) {
+    streamoff dataStart = inFile.tellg();
+    inFile.seekg(0, ios::end);
+    streamoff fileSize = inFile.tellg();
+    uint64_t indexOffset = 0;
+    if (fileSize < dataStart + static_cast<streamoff>(sizeof(indexOffset))) {
+        return false;
+    }
+    inFile.seekg(fileSize - static_cast<streamoff>(sizeof(indexOffset)));
+    inFile.read(reinterpret_cast<char*>(&indexOffset), sizeof(indexOffset));
+    streamoff indexEnd = fileSize - static_cast<streamoff>(sizeof(indexOffset));
+    if (!inFile || indexOffset < static_cast<uint64_t>(dataStart) || indexOffset > static_cast<uint64_t>(indexEnd)) {
+        return false;
+    }
+
+    string indexBytes(indexEnd - static_cast<streamoff>(indexOffset), '\0');
+    inFile.seekg(indexOffset);
+    inFile.read(&indexBytes[0], indexBytes.size());
+    ByteReader index(indexBytes);
+    uint64_t blockCount = index.varint();
+    if (!inFile || blockCount > indexBytes.size()) {
+        return false;
+    }
+    vector<DataBlock> blocks(blockCount);
+    size_t total = 0;
+    uint64_t hotEnd = indexOffset;
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        DataBlock &info = blocks[b];
+        info.hotOffset = index.varint();
+        info.coldOffset = index.varint();
+        info.records = index.varint();
+        info.hotSize = index.varint();
+        info.hotRawSize = index.varint();
+        info.coldSize = index.varint();
+        info.coldRawSize = index.varint();
+        total += info.records;
+        // coldRef relies on every block but the last being full
+        bool sized = b + 1 == blocks.size() ? info.records <= BLOCK_RECORDS : info.records == BLOCK_RECORDS;
+        if (!sized || info.hotOffset < static_cast<uint64_t>(dataStart) ||
+            info.hotOffset + info.hotSize > info.coldOffset || info.coldOffset + info.coldSize > indexOffset) {
+            index.ok = false;
+        }
+        hotEnd = b == 0 ? info.coldOffset : min<uint64_t>(hotEnd, info.coldOffset);
+    }
+    if (!index.ok || total != count) {
+        return false;
+    }
+    for (const auto &info : blocks) {
+        if (info.hotOffset + info.hotSize > hotEnd) {
+            return false;
+        }
+    }
+
+    // The dictionary and the hot parts are contiguous from the end of the
+    // header; the cold parts after them are left on disk
+    string head(hotEnd - dataStart, '\0');
+    inFile.seekg(dataStart);
+    inFile.read(&head[0], head.size());
+    ByteReader dictionary(head);
+    if (!inFile || !readLocalityDictionary(dictionary)) {
+        return false;
+    }
+
+    // Hot parts are written back to back and are already in memory
+    vector<size_t> firstRecord(blocks.size());
+    for (size_t b = 1; b < blocks.size(); ++b) {
+        firstRecord[b] = firstRecord[b - 1] + blocks[b - 1].records;
+    }
+    customers.assign(count, Customer());
+    atomic<bool> damaged(false);
+    size_t workers = min(partitionCount(count), max<size_t>(1, blocks.size()));
+    runPartitioned(blocks.size(), workers, [&](size_t, size_t begin, size_t end) {
+        string compressed;
+        string raw;
+        for (size_t b = begin; b < end; ++b) {
+            const DataBlock &info = blocks[b];
+            compressed.assign(head, info.hotOffset - dataStart, info.hotSize);
+            if (!lzDecompress(compressed, info.hotRawSize, raw)) {
+                damaged = true;
+                return;
+            }
+            ByteReader in(raw);
+            int previousID = 0;
+            for (uint32_t i = 0; i < info.records; ++i) {
+                Customer &customer = customers[firstRecord[b] + i];
+                decodeHotRecord(in, customer, previousID);
+                customer.coldRef = b * BLOCK_RECORDS + i;
+            }
+            if (!in.ok) {
+                damaged = true;
+                return;
+            }
+        }
+    });
+    if (damaged) {
+        customers.clear();
+        return false;
+    }
+
+    lock_guard<mutex> guard(coldCache.lock);
+    coldCache.file.open(path, ios::binary);
+    coldCache.blocks = blocks;
+    return true;
+}
+
+// Formats 3 and 4: fixed-size hot records, then text at per-record offsets.
+// Read eagerly; the next save converts the file to format 5. False if the
+// file is cut short.
+bool loadHotColdFile(ifstream &inFile, size_t count, uintmax_t fileSize) {
+    customers.reserve(count);
+    vector<int64_t> coldOffsets;
+    coldOffsets.reserve(count);
+    vector<HotRecord> batch;
+    for (size_t loaded = 0; loaded < count && inFile; ) {
+        size_t n = min(HOT_RECORDS_PER_READ, count - loaded);
+        batch.resize(n);
+        inFile.read(reinterpret_cast<char*>(batch.data()), n * sizeof(HotRecord));
+        n = inFile.gcount() / sizeof(HotRecord);
+        for (size_t i = 0; i < n; ++i) {
+            customers.push_back(customerFromHotRecord(batch[i]));
+            coldOffsets.push_back(batch[i].coldOffset);
+        }
+        loaded += n;
+    }
+    if (customers.size() != count) {
+        return false;
+    }
+
+    for (size_t i = 0; i < customers.size(); ++i) {
+        Customer &customer = customers[i];
+        inFile.clear();
+        inFile.seekg(coldOffsets[i]);
+        for (string *target : {&customer.name, &customer.address, &customer.contact}) {
+            uint32_t length = 0;
+            inFile.read(reinterpret_cast<char*>(&length), sizeof(length));
+            if (!inFile || length > fileSize) {
+                return false;
+            }
+            target->resize(length);
+            inFile.read(&(*target)[0], length);
+        }
+        if (!inFile) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Reads any format into customers; false if the file is missing or damaged.
+// Exits if the file comes from a newer version.
+bool loadDataFile(const string &path) {
+    ifstream inFile(path, ios::binary);
+    if (!inFile) {
+        return false;
+    }
+    error_code ec;
+    uintmax_t fileSize = filesystem::file_size(path, ec);
+
+    resetColdCache();
+    customers.clear();
+    size_t count = 0;
+    inFile.read(reinterpret_cast<char*>(&count), sizeof(count));
+
+    // Files written before due dates existed start directly with the count
+    uint32_t version = 1;
+    if (count == DATA_FILE_MAGIC) {
+        inFile.read(reinterpret_cast<char*>(&version), sizeof(version));
+        if (version > DATA_FILE_VERSION) {
+            // Running on with an empty book would overwrite it at the next save
+            cout << "Data file was written by a newer version (format " << version << ") and cannot be read.\n";
+            exit(1);
+        }
+        inFile.read(reinterpret_cast<char*>(&dunningClock), sizeof(dunningClock));
+        inFile.read(reinterpret_cast<char*>(&count), sizeof(count));
+    }
+    if (!inFile) {
+        return false;
+    }
+
+    if (version >= 5) {
+        return loadCompactFile(inFile, path, count);
+    }
+
+    // Every record in the older formats takes more than one byte
+    if (count > fileSize) {
+        return false;
+    }
+
+    // Format 4 adds the locality dictionary ahead of the hot records
+    if (version == 4) {
+        uint32_t localityCount = 0;
+        inFile.read(reinterpret_cast<char*>(&localityCount), sizeof(localityCount));
+        localityNames.clear();
+        localityIndex.clear();
+        for (uint32_t i = 0; i < localityCount && inFile; ++i) {
+            uint32_t length = 0;
+            inFile.read(reinterpret_cast<char*>(&length), sizeof(length));
+            string locality(length, '\0');
+            inFile.read(&locality[0], length);
+            localityIndex[toLowerCopy(locality)] = localityNames.size();
+            localityNames.push_back(locality);
+        }
+        if (localityNames.empty()) {
+            localityNames.push_back("Unknown");
+        }
+    }
+
+    if (version >= 3) {
+        if (!loadHotColdFile(inFile, count, fileSize)) {
+            customers.clear();
+            return false;
+        }
+        if (version == 3) {
+            // One-time upgrade: localities were not stored yet
+            for (auto &customer : customers) {
+                customer.localityID = localityIDFor(customer.address);
+            }
+        }
+        return true;
+    }
+
+    int today = daysFromDate(getCurrentDate());
+    // A length that runs past the end of the file means it is damaged
+    auto badLength = [&](size_t length) { return !inFile || length > fileSize; };
+    for (size_t i = 0; i < count; ++i) {
+        Customer customer;
+
+        // Read customer ID
+        inFile.read(reinterpret_cast<char*>(&customer.customerID), sizeof(customer.customerID));
+
+        // Read name
+        size_t nameLen;
+        inFile.read(reinterpret_cast<char*>(&nameLen), sizeof(nameLen));
+        if (badLength(nameLen)) {
+            customers.clear();
+            return false;
+        }
+        char* nameBuffer = new char[nameLen + 1];
+        inFile.read(nameBuffer, nameLen);
+        nameBuffer[nameLen] = '\0';
+        customer.name = nameBuffer;
+        delete[] nameBuffer;
+
+        // Read address
+        size_t addrLen;
+        inFile.read(reinterpret_cast<char*>(&addrLen), sizeof(addrLen));
+        if (badLength(addrLen)) {
+            customers.clear();
+            return false;
+        }
+        char* addrBuffer = new char[addrLen + 1];
+        inFile.read(addrBuffer, addrLen);
+        addrBuffer[addrLen] = '\0';
+        customer.address = addrBuffer;
+        delete[] addrBuffer;
+
+        // Read contact
+        size_t contactLen;
+        inFile.read(reinterpret_cast<char*>(&contactLen), sizeof(contactLen));
+        if (badLength(contactLen)) {
+            customers.clear();
+            return false;
+        }
+        char* contactBuffer = new char[contactLen + 1];
+        inFile.read(contactBuffer, contactLen);
+        contactBuffer[contactLen] = '\0';
+        customer.contact = contactBuffer;
+        delete[] contactBuffer;
+
+        // Read numeric data
+        inFile.read(reinterpret_cast<char*>(&customer.previousReading), sizeof(customer.previousReading));
+        inFile.read(reinterpret_cast<char*>(&customer.currentReading), sizeof(customer.currentReading));
+        inFile.read(reinterpret_cast<char*>(&customer.unitsConsumed), sizeof(customer.unitsConsumed));
+        inFile.read(reinterpret_cast<char*>(&customer.billAmount), sizeof(customer.billAmount));
+
+        // Read billing date
+        size_t dateLen;
+        inFile.read(reinterpret_cast<char*>(&dateLen), sizeof(dateLen));
+        if (badLength(dateLen)) {
+            customers.clear();
+            return false;
+        }
+        char* dateBuffer = new char[dateLen + 1];
+        inFile.read(dateBuffer, dateLen);
+        dateBuffer[dateLen] = '\0';
+        customer.billingDate = dateBuffer;
+        delete[] dateBuffer;
+
+        // Read payment status
+        inFile.read(reinterpret_cast<char*>(&customer.isPaid), sizeof(customer.isPaid));
+
+        // Read due date and dunning state
+        if (version >= 2) {
+            size_t dueLen;
+            inFile.read(reinterpret_cast<char*>(&dueLen), sizeof(dueLen));
+            if (badLength(dueLen)) {
+                customers.clear();
+                return false;
+            }
+            char* dueBuffer = new char[dueLen + 1];
+            inFile.read(dueBuffer, dueLen);
+            dueBuffer[dueLen] = '\0';
+            customer.dueDate = dueBuffer;
+            delete[] dueBuffer;
+
+            inFile.read(reinterpret_cast<char*>(&customer.lateFee), sizeof(customer.lateFee));
+            inFile.read(reinterpret_cast<char*>(&customer.dunningLevel), sizeof(customer.dunningLevel));
+        } else if (daysFromDate(customer.billingDate) >= 0) {
+            // Give old bills the full payment period from the day due dates
+            // were introduced, rather than backdating every dunning stage
+            int issued = max(daysFromDate(customer.billingDate), today);
+            customer.dueDate = dateFromDays(issued + BILL_DUE_DAYS);
+        }
+
+        if (!inFile) {
+            customers.clear();
+            return false;
+        }
+        customer.localityID = localityIDFor(customer.address);
+        customers.push_back(customer);
+    }
+
+    inFile.close();
+    return true;
+}
+
+void loadData() {
+    if (!filesystem::exists(DATA_FILE)) {
+        cout << "No existing data found. Starting with empty database.\n";
+        return;
+    }
+    if (!loadDataFile(DATA_FILE)) {
+        // Going on with an empty book would overwrite the file at the next save
+        cout << DATA_FILE << " is damaged and could not be loaded. Restore it from a backup\n"
+             << "or move it aside, then start again.\n";
+        exit(1);
+    }
+    cout << "Loaded " << customers.size() << " customer records.\n";
+    rebuildCustomerIndex();
+}
+
+// --compare-formats: writes the current customer book in format 4 and in
+// format 5, then reports file size and load time for each
+void compareDataFormats() {
+    loadData();
+    if (customers.empty()) {
+        cout << "No customers to compare.\n";
+        return;
+    }
+
+    const string legacyFile = DATA_FILE + ".format4";
+    const string compactFile = DATA_FILE + ".format5";
+    vector<DataBlock> blocks;
+    if (!writeHotColdFile(legacyFile) || !writeCompactFile(compactFile, blocks)) {
+        cout << "Error writing comparison files!\n";
+        return;
+    }
+
+    struct Row { const char *label; string path; };
+    const Row rows[] = {
+        {"Format 4 (fixed records, raw text)", legacyFile},
+        {"Format 5 (varint blocks, compressed)", compactFile}
+    };
+
+    cout << "\nCustomers: " << customers.size() << "\n\n";
+    cout << left << setw(38) << "Format" << right << setw(14) << "Size (bytes)"
+         << setw(12) << "Load (ms)" << setw(20) << "Load + text (ms)" << endl;
+    cout << string(84, '-') << endl;
+    uintmax_t legacySize = 0;
+    for (const Row &row : rows) {
+        uintmax_t size = filesystem::file_size(row.path);
+        legacySize = legacySize ? legacySize : size;
+
+        // Free the previous book first so its teardown is not timed
+        resetColdCache();
+        vector<Customer>().swap(customers);
+        auto start = chrono::steady_clock::now();
+        loadDataFile(row.path);
+        auto loaded = chrono::steady_clock::now();
+        for (const auto &customer : customers) {
+            customerName(customer);
+        }
+        auto touched = chrono::steady_clock::now();
+
+        cout << left << setw(38) << row.label << right << setw(14) << size << fixed << setprecision(1)
+             << setw(12) << chrono::duration<double, milli>(loaded - start).count()
+             << setw(20) << chrono::duration<double, milli>(touched - start).count() << endl;
+    }
+    cout << "\nFormat 5 is " << fixed << setprecision(1)
+         << 100.0 * filesystem::file_size(compactFile) / legacySize << "% of the format 4 size.\n";
+
+    resetColdCache();
+    filesystem::remove(legacyFile);
+    filesystem::remove(compactFile);
+}
+
+void saveTariff() {
+    ofstream outFile(TARIFF_FILE, ios::binary);
+    if (!outFile) {
+        cout << "Error saving tariff data!\n";
+        return;
+    }
+    
+    outFile.write(reinterpret_cast<const char*>(&currentTariff), sizeof(currentTariff));
+    outFile.close();
+}
+
+void loadTariff() {
+    ifstream inFile(TARIFF_FILE, ios::binary);
+    if (!inFile) {
+        cout << "No tariff data found. Using default rates.\n";
+        return;
+    }
+    
+    inFile.read(reinterpret_cast<char*>(&currentTariff), sizeof(currentTariff));
+    inFile.close();
+}
+
+string getCurrentDate() {
+    if (simulatedToday >= 0) {
+        return dateFromDays(simulatedToday);
+    }
+    
+    time_t now = time(0);
+    tm* localTime = localtime(&now);
+    
+    stringstream ss;
+    ss << (localTime->tm_year + 1900) << "-"
+       << setw(2) << setfill('0') << (localTime->tm_mon + 1) << "-"
+       << setw(2) << setfill('0') << localTime->tm_mday;
+    
+    return ss.str();
+}
+
+// Days since 1970-01-01 for a YYYY-MM-DD date, or -1 if the text is not a valid date
+int daysFromDate(const string &date) {
+    int year, month, day;
+    char dash1, dash2;
+    istringstream in(date);
+    if (date.size() != 10 || !(in >> year >> dash1 >> month >> dash2 >> day) ||
+        dash1 != '-' || dash2 != '-' || month < 1 || month > 12 || day < 1 || year < 1970) {
+        return -1;
+    }
+    static const int monthDays[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    if (day > monthDays[month - 1] + (month == 2 && leap ? 1 : 0)) {
+        return -1;
+    }
+
+    // Civil-to-days conversion with March as the first month of the year
+    year -= month <= 2;
+    int era = year / 400;
+    int yearOfEra = year - era * 400;
+    int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
+}
+
+string dateFromDays(int days) {
+    days += 719468;
+    int era = days / 146097;
+    int dayOfEra = days - era * 146097;
+    int yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    int dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    int monthIndex = (5 * dayOfYear + 2) / 153;
+    int day = dayOfYear - (153 * monthIndex + 2) / 5 + 1;
+    int month = monthIndex < 10 ? monthIndex + 3 : monthIndex - 9;
+    int year = yearOfEra + era * 400 + (month <= 2);
+
+    // Called for every stored date at load time, so the digits are written directly
+    if (year > 9999) {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%d-%02d-%02d", year, month, day);
+        return buffer;
+    }
+    string date = "0000-00-00";
+    for (int i = 3; i >= 0; --i, year /= 10) {
+        date[i] = '0' + year % 10;
+    }
+    date[5] = '0' + month / 10;
+    date[6] = '0' + month % 10;
+    date[8] = '0' + day / 10;
+    date[9] = '0' + day % 10;
+    return date;
+}
+
+// Locality is the last comma-separated part of the address ("12 Main St, Pune" -> "Pune")
+uint32_t localityIDFor(const string &address) {
+    size_t comma = address.rfind(',');
+    string locality = comma == string::npos ? address : address.substr(comma + 1);
+    locality.erase(0, locality.find_first_not_of(" \t"));
+    locality.erase(locality.find_last_not_of(" \t") + 1);
+    if (locality.empty()) {
+        return 0;
+    }
+
+    string key = toLowerCopy(locality);
+    auto found = localityIndex.find(key);
+    if (found != localityIndex.end()) {
+        return found->second;
+    }
+    // coldFields() reads the dictionary under this lock, possibly from the exporter thread
+    lock_guard<mutex> guard(coldCache.lock);
+    uint32_t id = localityNames.size();
+    localityNames.push_back(locality);
+    localityIndex[key] = id;
+    return id;
+}
+
+int generateCustomerID() {
+    static int lastID = 1000; // Starting ID
+    int sharedID = allocateSharedCustomerID();
+    if (sharedID > 0) {
+        return sharedID;
+    }
+    if (!customers.empty()) {
+        // Find the maximum ID in the existing customers
+        int maxID = 0;
+        for (const auto &customer : customers) {
+            if (customer.customerID > maxID) {
+                maxID = customer.customerID;
+            }
+        }
+        return maxID + 1;
+    }
+    return ++lastID;
+}
+
+void clearScreen() {
+    // Platform-specific screen clearing
+    #ifdef _WIN32
+        system("cls");
+    #else
+        system("clear");
+    #endif
+}
+
+void pressEnterToContinue() {
+    cout << "\nPress Enter to continue...";
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    cin.get();
+}
+
+double getValidDouble(const string &prompt) {
+    double value;
+    while (true) {
+        cout << prompt;
+        cin >> value;
+        
+        if (cin.fail() || value < 0) {
+            cin.clear();
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            cout << "Invalid input! Please enter a non-negative number.\n";
+        } else {
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            return value;
+        }
+    }
+}
+
+int getValidInt(const string &prompt) {
+    int value;
+    while (true) {
         cout << prompt;
         cin >> value;
         
@@ -874,4 +5681,28 @@ int getValidInt(const string &prompt) {
             return value;
         }
     }
-}
\ No newline at end of file
+}
+
+int getValidCategory() {
+    while (true) {
+        int choice = getValidInt("Tariff Category (1. Domestic, 2. Commercial, 3. Industrial): ");
+        if (choice >= 1 && choice <= CATEGORY_COUNT) {
+            return choice - 1;
+        }
+        cout << "Invalid category! Please enter 1, 2 or 3.\n";
+    }
+}
+
+// field is 1 name, 2 address or 3 contact, as in the update menu
+string getValidText(const string &prompt, int field) {
+    size_t limit = sharedStore.active ? sharedTextLimit(field) : numeric_limits<size_t>::max();
+    while (true) {
+        string value;
+        cout << prompt;
+        getline(cin, value);
+        if (value.size() <= limit) {
+            return value;
+        }
+        cout << "Too long! Shared mode allows at most " << limit << " characters here.\n";
+    }
+}